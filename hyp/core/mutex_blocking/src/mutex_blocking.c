@@ -0,0 +1,271 @@
+// © 2021 Qualcomm Innovation Center, Inc. All rights reserved.
+//
+// SPDX-License-Identifier: BSD-3-Clause
+
+// Blocking implementation of mutexes, for configurations with a scheduler in
+// the hypervisor.
+//
+// An uncontended mutex is acquired with a single atomic operation. A contended
+// acquire polls for a short time, in case the owner is about to release it,
+// and then blocks. Release hands the mutex directly to the longest waiting
+// thread, so waiters are served in FIFO order and can't be overtaken by new
+// arrivals. Unlike a spinlock, a mutex may be held with preemption enabled,
+// and waiting for it does not occupy a CPU.
+//
+// A thread that blocks on a mutex lends its priority to the owner, and through
+// it to the owner of any mutex the owner is blocked on, so a high-priority
+// waiter is not held up by medium-priority threads preempting a low-priority
+// owner. The inherited priority is kept until the owner has released all of
+// its mutexes; this is conservative, but avoids tracking which waiters boosted
+// the owner through which mutex.
+
+#include <assert.h>
+#include <hyptypes.h>
+
+#include <hypcontainers.h>
+
+#include <atomic.h>
+#include <compiler.h>
+#include <list.h>
+#include <mutex.h>
+#include <object.h>
+#include <preempt.h>
+#include <rcu.h>
+#include <scheduler.h>
+#include <spinlock.h>
+#include <thread.h>
+#include <util.h>
+
+#include <asm/barrier.h>
+
+#include <events/mutex.h>
+
+#include "event_handlers.h"
+
+scheduler_block_properties_t
+mutex_handle_scheduler_get_block_properties(scheduler_block_t block)
+{
+	assert(block == SCHEDULER_BLOCK_MUTEX);
+
+	scheduler_block_properties_t props =
+		scheduler_block_properties_default();
+	scheduler_block_properties_set_non_killable(&props, true);
+
+	return props;
+}
+
+void
+mutex_init(mutex_t *lock)
+{
+	atomic_init(&lock->owner, NULL);
+	list_init(&lock->waiters);
+	spinlock_init(&lock->lock);
+	trigger_mutex_init_event(lock);
+}
+
+static bool
+mutex_try_take(mutex_t *lock, thread_t *self)
+{
+	thread_t *owner = NULL;
+
+	return atomic_compare_exchange_strong_explicit(&lock->owner, &owner,
+						       self,
+						       memory_order_acquire,
+						       memory_order_relaxed);
+}
+
+// Raise the inherited priority of the owner of the given mutex to at least the
+// given priority, and repeat for the mutex that the owner is blocked on, if
+// any. Called with preemption disabled and no spinlocks held.
+//
+// Mutexes are only freed after an RCU grace period, like the objects that
+// contain them, so the chain can be followed in an RCU read-side section.
+static void
+mutex_propagate_priority(mutex_t *lock, priority_t priority)
+{
+	mutex_t *next = lock;
+
+	rcu_read_start();
+	for (count_t depth = 0U;
+	     (next != NULL) && (depth < MUTEX_PI_MAX_DEPTH); depth++) {
+		thread_t *owner = atomic_load_consume(&next->owner);
+		next		= NULL;
+		if ((owner == NULL) || !object_get_thread_safe(owner)) {
+			break;
+		}
+
+		scheduler_lock_nopreempt(owner);
+		// Mark the owner before checking whether it still holds a
+		// mutex; this pairs with the held count decrement in
+		// mutex_drop_inherited_priority(), so either we see the
+		// release or the releasing thread sees the mark.
+		atomic_store_explicit(&owner->mutex_pi_boosted, true,
+				      memory_order_seq_cst);
+		if ((atomic_load_explicit(&owner->mutex_held_count,
+					  memory_order_seq_cst) != 0U) &&
+		    (scheduler_get_effective_priority(owner) < priority)) {
+			scheduler_set_inherited_priority(owner, priority);
+			next = atomic_load_relaxed(&owner->mutex_waiting_on);
+		}
+		scheduler_unlock_nopreempt(owner);
+
+		object_put_thread(owner);
+	}
+	rcu_read_finish();
+}
+
+// Drop the current thread's inherited priority if it no longer holds any
+// mutexes. Called with preemption disabled.
+static void
+mutex_drop_inherited_priority(thread_t *self)
+{
+	count_t held = atomic_fetch_sub_explicit(&self->mutex_held_count, 1U,
+						 memory_order_seq_cst);
+	assert(held != 0U);
+
+	if ((held == 1U) && atomic_load_explicit(&self->mutex_pi_boosted,
+						 memory_order_seq_cst)) {
+		scheduler_lock_nopreempt(self);
+		if (atomic_load_relaxed(&self->mutex_held_count) == 0U) {
+			atomic_store_relaxed(&self->mutex_pi_boosted, false);
+			scheduler_set_inherited_priority(
+				self, SCHEDULER_MIN_PRIORITY);
+		}
+		scheduler_unlock_nopreempt(self);
+	}
+}
+
+void
+mutex_acquire(mutex_t *lock) LOCK_IMPL
+{
+	thread_t *self = thread_get_self();
+
+	assert_preempt_enabled();
+	assert(atomic_load_relaxed(&lock->owner) != self);
+
+	trigger_mutex_acquire_event(lock);
+
+	// Count the mutex as held before taking it, so a waiter that sees us
+	// as the owner will always boost us.
+	(void)atomic_fetch_add_explicit(&self->mutex_held_count, 1U,
+					memory_order_relaxed);
+
+	// Poll without writing to the mutex, to avoid stealing its cache line
+	// from the owner.
+	bool taken = false;
+	for (count_t i = 0U; !taken && (i < MUTEX_SPIN_ITERATIONS); i++) {
+		if (atomic_load_relaxed(&lock->owner) == NULL) {
+			taken = mutex_try_take(lock, self);
+		} else {
+			asm_yield();
+		}
+	}
+
+	if (!taken) {
+		spinlock_acquire(&lock->lock);
+		// The owner may have released it since we last polled.
+		taken = mutex_try_take(lock, self);
+		priority_t priority = SCHEDULER_MIN_PRIORITY;
+		if (!taken) {
+			list_insert_at_tail(&lock->waiters,
+					    &self->mutex_wait_node);
+			scheduler_lock_nopreempt(self);
+			priority = scheduler_get_effective_priority(self);
+			atomic_store_relaxed(&self->mutex_waiting_on, lock);
+			scheduler_block(self, SCHEDULER_BLOCK_MUTEX);
+			scheduler_unlock_nopreempt(self);
+		}
+		spinlock_release_nopreempt(&lock->lock);
+
+		if (!taken) {
+			mutex_propagate_priority(lock, priority);
+		}
+
+		// Wait for the owner to hand the mutex over to us. This
+		// returns immediately if it already has.
+		while (atomic_load_acquire(&lock->owner) != self) {
+			scheduler_yield();
+		}
+		preempt_enable();
+	}
+
+	trigger_mutex_acquired_event(lock);
+}
+
+bool
+mutex_trylock(mutex_t *lock) LOCK_IMPL
+{
+	trigger_mutex_acquire_event(lock);
+
+	thread_t *self = thread_get_self();
+	(void)atomic_fetch_add_explicit(&self->mutex_held_count, 1U,
+					memory_order_relaxed);
+
+	bool taken = mutex_try_take(lock, self);
+	if (taken) {
+		trigger_mutex_acquired_event(lock);
+	} else {
+		preempt_disable();
+		mutex_drop_inherited_priority(self);
+		preempt_enable();
+		trigger_mutex_failed_event(lock);
+	}
+
+	return taken;
+}
+
+void
+mutex_release(mutex_t *lock) LOCK_IMPL
+{
+	bool	  need_schedule = false;
+	thread_t *self		= thread_get_self();
+
+	assert(atomic_load_relaxed(&lock->owner) == self);
+
+	trigger_mutex_release_event(lock);
+
+	spinlock_acquire(&lock->lock);
+	list_node_t *node = list_get_head(&lock->waiters);
+	if (node == NULL) {
+		atomic_store_release(&lock->owner, NULL);
+	} else {
+		thread_t *next = thread_container_of_mutex_wait_node(node);
+
+		(void)list_delete_node(&lock->waiters, node);
+		atomic_store_release(&lock->owner, next);
+
+		// The new owner inherits the priority of the remaining
+		// waiters. Read their current priorities rather than the ones
+		// they queued with, since they may have been boosted while
+		// waiting.
+		priority_t priority = SCHEDULER_MIN_PRIORITY;
+		thread_t  *waiter;
+		list_foreach_container (waiter, &lock->waiters, thread,
+					mutex_wait_node) {
+			scheduler_lock_nopreempt(waiter);
+			priority = util_max(
+				priority,
+				scheduler_get_effective_priority(waiter));
+			scheduler_unlock_nopreempt(waiter);
+		}
+
+		scheduler_lock_nopreempt(next);
+		atomic_store_relaxed(&next->mutex_waiting_on, NULL);
+		if (scheduler_get_effective_priority(next) < priority) {
+			atomic_store_relaxed(&next->mutex_pi_boosted, true);
+			scheduler_set_inherited_priority(next, priority);
+		}
+		need_schedule = scheduler_unblock(next, SCHEDULER_BLOCK_MUTEX);
+		scheduler_unlock_nopreempt(next);
+	}
+	spinlock_release_nopreempt(&lock->lock);
+
+	mutex_drop_inherited_priority(self);
+
+	if (need_schedule) {
+		scheduler_trigger();
+	}
+	preempt_enable();
+
+	trigger_mutex_released_event(lock);
+}
@@ -4,6 +4,7 @@
 
 #include <assert.h>
 #include <hyptypes.h>
+#include <hypcall_def.h>
 
 #include <atomic.h>
 #include <compiler.h>
@@ -11,18 +12,27 @@
 #include <enum.h>
 #include <idle.h>
 #include <ipi.h>
+#include <partition.h>
 #include <preempt.h>
 #include <rcu.h>
 #include <scheduler.h>
+#include <thread.h>
 #include <util.h>
 
 #include <events/rcu.h>
 
+#include <asm/timestamp.h>
+
 #include "event_handlers.h"
 
-static_assert(PLATFORM_MAX_CORES <= 32U, "PLATFORM_MAX_CORES > 32");
+#define RCU_NUM_LEAVES                                                         \
+	((PLATFORM_MAX_CORES + RCU_LEAF_CPUS - 1U) / RCU_LEAF_CPUS)
+
+static_assert(RCU_LEAF_CPUS <= 32U, "RCU_LEAF_CPUS > 32");
+static_assert(RCU_NUM_LEAVES <= 32U, "PLATFORM_MAX_CORES > 32 * RCU_LEAF_CPUS");
 
 static rcu_state_t rcu_state;
+static rcu_leaf_t  rcu_leaves[RCU_NUM_LEAVES];
 CPULOCAL_DECLARE_STATIC(rcu_cpu_state_t, rcu_state);
 
 // The grace period counts can wrap around, so we can't use a simple comparison
@@ -57,23 +67,106 @@ rcu_read_finish(void) LOCK_IMPL
 	preempt_enable();
 }
 
+// Statistics are only written by their own CPU, so a load / store pair is
+// sufficient; the atomics only prevent torn reads by other CPUs.
+static void
+rcu_bitmap_stat_add(_Atomic uint64_t *counter, uint64_t value)
+{
+	atomic_store_relaxed(counter, atomic_load_relaxed(counter) + value);
+}
+
+static void
+rcu_bitmap_stat_max(_Atomic uint64_t *counter, uint64_t value)
+{
+	if (value > atomic_load_relaxed(counter)) {
+		atomic_store_relaxed(counter, value);
+	}
+}
+
+static inline index_t
+rcu_bitmap_leaf_index(cpu_index_t cpu)
+{
+	return (index_t)cpu / RCU_LEAF_CPUS;
+}
+
+static inline uint32_t
+rcu_bitmap_leaf_cpu_bit(cpu_index_t cpu)
+{
+	return (uint32_t)util_bit((index_t)cpu % RCU_LEAF_CPUS);
+}
+
+static inline cpu_index_t
+rcu_bitmap_leaf_cpu(index_t leaf_index, uint32_t cpu_bits)
+{
+	return (cpu_index_t)((leaf_index * RCU_LEAF_CPUS) +
+			     compiler_ctz(cpu_bits));
+}
+
+// Returns the bitmap of leaves that have any active CPUs.
+static uint32_t
+rcu_bitmap_active_leaves(void)
+{
+	uint32_t active_leaves = 0U;
+
+	for (index_t i = 0U; i < RCU_NUM_LEAVES; i++) {
+		if (atomic_load_relaxed(&rcu_leaves[i].active_cpus) != 0U) {
+			active_leaves |= (uint32_t)util_bit(i);
+		}
+	}
+
+	return active_leaves;
+}
+
 static void
 rcu_bitmap_refresh_active(void)
 {
-	uint32_t active_cpus = atomic_load_relaxed(&rcu_state.active_cpus);
-	while (active_cpus != 0U) {
-		cpu_index_t cpu = (cpu_index_t)compiler_ctz(active_cpus);
-		// Request a reschedule, since it will either switch threads,
-		// or trigger a scheduler quiescent event. We don't directly
-		// send an IPI_REASON_RCU_QUIESCE here since when in the idle
-		// thread, it may not return true and won't exit the fast-IPI
-		// loop, so the idle_yield event won't be rerun and the CPU
-		// won't be deactivated.
-		ipi_one(IPI_REASON_RESCHEDULE, cpu);
-		active_cpus &= (uint32_t)(~util_bit(cpu));
+	for (index_t i = 0U; i < RCU_NUM_LEAVES; i++) {
+		uint32_t active_cpus =
+			atomic_load_relaxed(&rcu_leaves[i].active_cpus);
+		while (active_cpus != 0U) {
+			cpu_index_t cpu = rcu_bitmap_leaf_cpu(i, active_cpus);
+			// Request a reschedule, since it will either switch
+			// threads, or trigger a scheduler quiescent event. We
+			// don't directly send an IPI_REASON_RCU_QUIESCE here
+			// since when in the idle thread, it may not return
+			// true and won't exit the fast-IPI loop, so the
+			// idle_yield event won't be rerun and the CPU won't
+			// be deactivated.
+			ipi_one(IPI_REASON_RESCHEDULE, cpu);
+			active_cpus &= active_cpus - 1U;
+		}
 	}
 }
 
+// Force the active CPUs in the specified leaves, other than the current CPU,
+// to pass through a quiescent state, to expedite a grace period.
+static void
+rcu_bitmap_force_quiesce(uint32_t leaf_bits, cpu_index_t this_cpu)
+{
+	uint64_t ipis = 0U;
+
+	while (leaf_bits != 0U) {
+		index_t	 i	     = (index_t)compiler_ctz(leaf_bits);
+		uint32_t active_cpus =
+			atomic_load_relaxed(&rcu_leaves[i].active_cpus);
+		while (active_cpus != 0U) {
+			cpu_index_t cpu = rcu_bitmap_leaf_cpu(i, active_cpus);
+			active_cpus &= active_cpus - 1U;
+			if (cpu == this_cpu) {
+				continue;
+			}
+			// A reschedule is used rather than a quiesce, for the
+			// reasons given in rcu_bitmap_refresh_active().
+			ipi_one(IPI_REASON_RESCHEDULE, cpu);
+			ipis++;
+		}
+		leaf_bits &= leaf_bits - 1U;
+	}
+
+	(void)atomic_fetch_add_explicit(&rcu_state.stats.expedite_ipis, ipis,
+					memory_order_relaxed);
+}
+
 static inline bool
 rcu_bitmap_should_run(void)
 {
@@ -112,6 +205,12 @@ rcu_enqueue(rcu_entry_t *rcu_entry, rcu_update_class_t rcu_update_class)
 	rcu_entry->next		       = batch->heads[rcu_update_class];
 	batch->heads[rcu_update_class] = rcu_entry;
 
+	if (batch->start_time == 0U) {
+		batch->start_time = arch_get_timestamp();
+	}
+	rcu_bitmap_stat_add(&my_state->stats.classes[rcu_update_class].enqueued,
+			    1U);
+
 	// Trigger a relaxed IPI to request a new GP if possible. We could call
 	// rcu_bitmap_notify() directly here, but using an IPI to defer it will
 	// improve batching when there is no GP already in progress.
@@ -126,14 +225,15 @@ rcu_bitmap_activate_cpu(void) REQUIRE_PREEMPT_DISABLED
 {
 	assert_cpulocal_safe();
 	cpu_index_t	 cpu	  = cpulocal_get_index();
-	uint32_t	 cpu_bit  = (uint32_t)util_bit(cpu);
 	rcu_cpu_state_t *my_state = &CPULOCAL_BY_INDEX(rcu_state, cpu);
 
 	if (compiler_unexpected(!my_state->is_active)) {
 		// We're not in the active CPU set. Add ourselves.
 		my_state->is_active = true;
 
-		(void)atomic_fetch_or_explicit(&rcu_state.active_cpus, cpu_bit,
+		rcu_leaf_t *leaf = &rcu_leaves[rcu_bitmap_leaf_index(cpu)];
+		(void)atomic_fetch_or_explicit(&leaf->active_cpus,
+					       rcu_bitmap_leaf_cpu_bit(cpu),
 					       memory_order_relaxed);
 
 		// Fence to ensure that we are in the active CPU set before
@@ -143,8 +243,9 @@ rcu_bitmap_activate_cpu(void) REQUIRE_PREEMPT_DISABLED
 		// will see this CPU as active. This must be a seq_cst fence to
 		// order loads after stores.
 		//
-		// The matching fence is in rcu_bitmap_quiesce(), when (and if)
-		// it reads the active bitmap to copy it to the current bitmap.
+		// The matching fences are in rcu_bitmap_root_ack() and
+		// rcu_bitmap_leaf_ack(), when they read the active bitmaps to
+		// start a grace period in the root or in a leaf.
 		atomic_thread_fence(memory_order_seq_cst);
 	}
 }
@@ -163,6 +264,19 @@ rcu_bitmap_handle_preempt_interrupt(void)
 	return false;
 }
 
+// Continue processing a ready batch that rcu_bitmap_update() stopped early.
+// This is called from the scheduler, so a large batch is processed in bounded
+// chunks with interrupts and thread switches allowed in between.
+static void
+rcu_bitmap_continue_update(void) REQUIRE_PREEMPT_DISABLED
+{
+	if (compiler_unexpected(CPULOCAL(rcu_state).update_deferred)) {
+		if (rcu_bitmap_update()) {
+			scheduler_trigger();
+		}
+	}
+}
+
 error_t
 rcu_bitmap_handle_thread_context_switch_pre(void)
 {
@@ -175,6 +289,7 @@ rcu_bitmap_handle_thread_context_switch_pre(void)
 		if (rcu_bitmap_quiesce()) {
 			scheduler_trigger();
 		}
+		rcu_bitmap_continue_update();
 	}
 
 	return OK;
@@ -192,8 +307,8 @@ rcu_bitmap_deactivate_cpu(void) REQUIRE_PREEMPT_DISABLED
 {
 	assert_preempt_disabled();
 	cpu_index_t	 cpu	  = cpulocal_get_index();
-	uint32_t	 cpu_bit  = (uint32_t)util_bit(cpu);
 	rcu_cpu_state_t *my_state = &CPULOCAL_BY_INDEX(rcu_state, cpu);
+	rcu_leaf_t	*leaf	  = &rcu_leaves[rcu_bitmap_leaf_index(cpu)];
 
 	my_state->is_active = false;
 
@@ -201,14 +316,16 @@ rcu_bitmap_deactivate_cpu(void) REQUIRE_PREEMPT_DISABLED
 	// ensure that it is done after the end of any critical sections.
 	// However, it does not need ordering relative to the quiesce below;
 	// if it happens late then at worst we might get a redundant IPI.
-	(void)atomic_fetch_and_explicit(&rcu_state.active_cpus, ~cpu_bit,
+	(void)atomic_fetch_and_explicit(&leaf->active_cpus,
+					~rcu_bitmap_leaf_cpu_bit(cpu),
 					memory_order_relaxed);
 
-	// This sequential consistency fence matches the one in
-	// rcu_bitmap_quiesce when a new grace period starts, to ensure that
-	// either this CPU goes first and clears its active bit (and the other
-	// CPU sends us a quiesce IPI), or the other CPU goes first and starts
-	// the new grace period before the quiesce.
+	// This sequential consistency fence matches the ones in
+	// rcu_bitmap_root_ack() and rcu_bitmap_leaf_ack() when a new grace
+	// period starts, to ensure that either this CPU goes first and clears
+	// its active bit (and the other CPU acknowledges the period for us or
+	// sends us a quiesce IPI), or the other CPU goes first and starts the
+	// new grace period before the quiesce.
 	atomic_thread_fence(memory_order_seq_cst);
 
 	(void)ipi_clear(IPI_REASON_RCU_QUIESCE);
@@ -217,10 +334,21 @@ rcu_bitmap_deactivate_cpu(void) REQUIRE_PREEMPT_DISABLED
 	}
 }
 
+static inline bool
+rcu_bitmap_should_deactivate(void) REQUIRE_PREEMPT_DISABLED
+{
+	// Isolated CPUs deactivate even when RCU is idle, so that the first
+	// update queued afterwards doesn't need to IPI them. The cost is some
+	// atomic updates of the shared state on each exit from the hypervisor,
+	// which is acceptable for CPUs that are expected to exit rarely.
+	return compiler_unexpected(rcu_bitmap_should_run()) ||
+	       compiler_unexpected(CPULOCAL(rcu_state).is_isolated);
+}
+
 idle_state_t
 rcu_bitmap_handle_idle_yield(void)
 {
-	if (compiler_unexpected(rcu_bitmap_should_run())) {
+	if (rcu_bitmap_should_deactivate()) {
 		rcu_bitmap_deactivate_cpu();
 	}
 
@@ -238,7 +366,7 @@ rcu_bitmap_handle_vcpu_block_finish(void)
 void
 rcu_bitmap_handle_thread_exit_to_user(void)
 {
-	if (compiler_unexpected(rcu_bitmap_should_run())) {
+	if (rcu_bitmap_should_deactivate()) {
 		rcu_bitmap_deactivate_cpu();
 	}
 }
@@ -271,95 +399,275 @@ rcu_bitmap_handle_scheduler_quiescent(void)
 	if (rcu_bitmap_quiesce()) {
 		scheduler_trigger();
 	}
+	rcu_bitmap_continue_update();
 }
 
-// Handlers for internal IPIs
-bool
-rcu_bitmap_quiesce(void)
+void
+rcu_bitmap_handle_scheduler_cpu_isolation_changed(bool isolated)
 {
-	assert_preempt_disabled();
-	cpu_index_t this_cpu = cpulocal_get_index();
-	uint32_t    cpu_bit  = (uint32_t)util_bit(this_cpu);
+	// The CPU will leave the active set the next time it goes idle or
+	// returns to a VM.
+	CPULOCAL(rcu_state).is_isolated = isolated;
+}
+
+// Acknowledge a grace period in a leaf on behalf of the specified CPUs, which
+// may be none. If the leaf has not started tracking the grace period yet, it
+// starts now, and waits for all of its currently active CPUs.
+//
+// Returns true if this call completed the grace period in the leaf, in which
+// case the caller must clear the leaf's bit in the global state. Sets *stale
+// if the global grace period has moved on, in which case nothing was done.
+static bool
+rcu_bitmap_leaf_ack(index_t leaf_index, uint32_t cpu_bits,
+		    count_t generation, bool *stale) REQUIRE_PREEMPT_DISABLED
+{
+	rcu_leaf_t *leaf = &rcu_leaves[leaf_index];
+	bool	    done;
 	bool	    new_period;
-	bool	    reschedule = false;
+
+	*stale = false;
 
 	rcu_grace_period_t current_period =
-		atomic_load_acquire(&rcu_state.current_period);
+		atomic_load_acquire(&leaf->current_period);
 	rcu_grace_period_t next_period;
 
 	do {
+		done	    = false;
+		new_period  = false;
 		next_period = current_period;
 
-		next_period.cpu_bitmap &= ~cpu_bit;
-
-		if (next_period.cpu_bitmap != 0U) {
-			// There are still other CPUs to wait for, so we are not
-			// starting a new period.
-			new_period = false;
+		if (current_period.generation == generation) {
+			if ((current_period.cpu_bitmap & cpu_bits) == 0U) {
+				// Nothing to acknowledge.
+				break;
+			}
 		} else {
-			// We're the last CPU to acknowledge the current period.
-			// Start a new one if there is a CPU that hasn't reached
-			// its target yet.
-			new_period =
-				atomic_load_relaxed(&rcu_state.max_target) !=
-				current_period.generation;
-
-			if (new_period) {
-				// Fence to ensure that the load of the new
-				// active CPU set occurs after any stores on
-				// this CPU that must occur before a new grace
-				// period starts. This matches the fence in
-				// rcu_bitmap_activate_cpu().
-				//
-				// Note that stores on other CPUs are ordered by
-				// the acquire operation on the CPU bitmap load
-				// on this CPU and the release operation on the
-				// CPU bitmap store on the other CPUs (below).
-				atomic_thread_fence(memory_order_seq_cst);
-
-				next_period.cpu_bitmap = atomic_load_relaxed(
-					&rcu_state.active_cpus);
-				next_period.generation++;
+			rcu_grace_period_t root_period =
+				atomic_load_relaxed(&rcu_state.current_period);
+			if (root_period.generation != generation) {
+				// The grace period ended without us, so the
+				// leaf must have been acknowledged by someone
+				// else.
+				*stale = true;
+				break;
 			}
+
+			// This is the first acknowledgement of the grace
+			// period in this leaf. Fence to ensure that the load
+			// of the active CPU set occurs after any stores on
+			// this CPU that must occur before the grace period
+			// starts. This matches the fence in
+			// rcu_bitmap_activate_cpu().
+			atomic_thread_fence(memory_order_seq_cst);
+
+			next_period.generation = generation;
+			next_period.cpu_bitmap =
+				atomic_load_relaxed(&leaf->active_cpus);
+			new_period = true;
 		}
+
+		next_period.cpu_bitmap &= ~cpu_bits;
+		done = next_period.cpu_bitmap == 0U;
 	} while (!atomic_compare_exchange_strong_explicit(
-		&rcu_state.current_period, &current_period, next_period,
+		&leaf->current_period, &current_period, next_period,
 		memory_order_acq_rel, memory_order_acquire));
 
 	if (new_period) {
 		// This matches the thread fence in rcu_bitmap_deactivate_cpu.
 		atomic_thread_fence(memory_order_seq_cst);
 
-		// Check the CPUs that have raced with us in deactivate.
+		// Check the CPUs that have raced with us in deactivate; they
+		// may have quiesced before the leaf started the period.
 		uint32_t cpus_needing_quiesce =
 			next_period.cpu_bitmap &
-			~atomic_load_relaxed(&rcu_state.active_cpus);
+			~atomic_load_relaxed(&leaf->active_cpus);
+		while (cpus_needing_quiesce != 0U) {
+			ipi_one(IPI_REASON_RCU_QUIESCE,
+				rcu_bitmap_leaf_cpu(leaf_index,
+						    cpus_needing_quiesce));
+			cpus_needing_quiesce &= cpus_needing_quiesce - 1U;
+		}
+	}
+
+	return done;
+}
 
-		// Successfully started a new period. Look for any remote CPUs
-		// that may be waiting for it, and IPI them.
-		for (cpu_index_t cpu = 0U; cpu < PLATFORM_MAX_CORES; cpu++) {
+// Send a notify IPI to every remote CPU that is waiting for the specified grace
+// period to start.
+static void
+rcu_bitmap_notify_waiters(count_t generation, cpu_index_t this_cpu)
+{
+	for (index_t i = 0U; i < RCU_NUM_LEAVES; i++) {
+		uint32_t waiting_cpus =
+			atomic_load_relaxed(&rcu_leaves[i].waiting_cpus);
+		while (waiting_cpus != 0U) {
+			cpu_index_t cpu = rcu_bitmap_leaf_cpu(i, waiting_cpus);
+			waiting_cpus &= waiting_cpus - 1U;
 			if (cpu == this_cpu) {
 				continue;
 			}
 			count_t target = atomic_load_relaxed(
 				&CPULOCAL_BY_INDEX(rcu_state, cpu).target);
-			if (!is_before(next_period.generation, target)) {
+			if (!is_before(generation, target)) {
 				ipi_one(IPI_REASON_RCU_NOTIFY, cpu);
 			}
-			// Handle any new CPUs needing quiesce due to a race
-			// where they are deactivating themselves and us
-			// reading the active_cpus for the next grace period
-			// above.
-			if ((cpus_needing_quiesce & util_bit(cpu)) != 0U) {
-				ipi_one(IPI_REASON_RCU_QUIESCE, cpu);
+		}
+	}
+}
+
+// Clear the specified leaves, which may be none, from the global grace period,
+// and start a new grace period if the current one has ended and a CPU is
+// waiting for another one. Returns true if a new grace period was started.
+static bool
+rcu_bitmap_root_ack(uint32_t leaf_bits, cpu_index_t this_cpu)
+	REQUIRE_PREEMPT_DISABLED
+{
+	bool	 started = false;
+	uint32_t acked	 = leaf_bits;
+
+	rcu_grace_period_t current_period =
+		atomic_load_acquire(&rcu_state.current_period);
+	rcu_grace_period_t next_period;
+
+	do {
+		bool new_period;
+
+		do {
+			next_period = current_period;
+
+			next_period.cpu_bitmap &= ~acked;
+
+			if (next_period.cpu_bitmap != 0U) {
+				// There are still other leaves to wait for, so
+				// we are not starting a new period.
+				new_period = false;
+			} else {
+				// The current period has ended. Start a new
+				// one if there is a CPU that hasn't reached
+				// its target yet.
+				new_period = atomic_load_relaxed(
+						     &rcu_state.max_target) !=
+					     current_period.generation;
+
+				if (new_period) {
+					// Fence to ensure that the loads of
+					// the leaves' active CPU sets occur
+					// after any stores on this CPU that
+					// must occur before a new grace period
+					// starts. This matches the fence in
+					// rcu_bitmap_activate_cpu().
+					//
+					// Note that stores on other CPUs are
+					// ordered by the acquire operation on
+					// the bitmap load on this CPU and the
+					// release operation on the bitmap
+					// stores on the other CPUs (below and
+					// in rcu_bitmap_leaf_ack()).
+					atomic_thread_fence(
+						memory_order_seq_cst);
+
+					next_period.cpu_bitmap =
+						rcu_bitmap_active_leaves();
+					next_period.generation++;
+				}
+			}
+		} while (!atomic_compare_exchange_strong_explicit(
+			&rcu_state.current_period, &current_period,
+			next_period, memory_order_acq_rel,
+			memory_order_acquire));
+
+		acked = 0U;
+
+		if (new_period) {
+			started = true;
+
+			// This matches the thread fence in
+			// rcu_bitmap_deactivate_cpu.
+			atomic_thread_fence(memory_order_seq_cst);
+
+			// If anyone is waiting for an expedited grace period,
+			// don't wait for the CPUs to quiesce by themselves.
+			count_t expedite_count =
+				atomic_load_relaxed(&rcu_state.expedite_count);
+			if (compiler_unexpected(expedite_count != 0U)) {
+				(void)atomic_fetch_add_explicit(
+					&rcu_state.stats.expedited_periods, 1U,
+					memory_order_relaxed);
+				rcu_bitmap_force_quiesce(next_period.cpu_bitmap,
+							 this_cpu);
+			}
+
+			// Leaves whose CPUs have all deactivated since we read
+			// their active sets may have no CPU left to acknowledge
+			// the new period, so acknowledge it for them. If that
+			// completes it, go around again to clear their bits.
+			uint32_t idle_leaves = next_period.cpu_bitmap &
+					       ~rcu_bitmap_active_leaves();
+			while (idle_leaves != 0U) {
+				index_t i = (index_t)compiler_ctz(idle_leaves);
+				bool	stale;
+				if (rcu_bitmap_leaf_ack(i, 0U,
+							next_period.generation,
+							&stale)) {
+					acked |= (uint32_t)util_bit(i);
+				}
+				idle_leaves &= idle_leaves - 1U;
 			}
+
+			// Look for any remote CPUs that may be waiting for the
+			// new period, and IPI them.
+			rcu_bitmap_notify_waiters(next_period.generation,
+						  this_cpu);
+
+			current_period = next_period;
 		}
+	} while (acked != 0U);
+
+	return started;
+}
+
+// Handlers for internal IPIs
+bool
+rcu_bitmap_quiesce(void)
+{
+	assert_preempt_disabled();
+	cpu_index_t this_cpu   = cpulocal_get_index();
+	index_t	    leaf_index = rcu_bitmap_leaf_index(this_cpu);
+	uint32_t    leaf_bit   = (uint32_t)util_bit(leaf_index);
+	uint32_t    acked      = 0U;
+	bool	    reschedule = false;
+
+	rcu_grace_period_t current_period =
+		atomic_load_acquire(&rcu_state.current_period);
 
-		// Process the grace period completion on the current CPU.
-		reschedule = rcu_bitmap_notify();
+	// Acknowledge the current period in our leaf, if it is still waiting
+	// for the leaf. The leaf only updates the global state if we are the
+	// last of its CPUs to acknowledge the period.
+	while ((current_period.cpu_bitmap & leaf_bit) != 0U) {
+		bool stale;
+		if (rcu_bitmap_leaf_ack(leaf_index,
+					rcu_bitmap_leaf_cpu_bit(this_cpu),
+					current_period.generation, &stale)) {
+			acked = leaf_bit;
+		}
+		if (!stale) {
+			break;
+		}
+		current_period = atomic_load_acquire(&rcu_state.current_period);
+	}
 
-		// Trigger another quiesce on the current CPU.
-		ipi_one_relaxed(IPI_REASON_RCU_QUIESCE, this_cpu);
+	// If the period has ended, either because we were the last CPU to
+	// acknowledge it or because it ended earlier, start a new one if
+	// necessary.
+	if ((acked != 0U) || (current_period.cpu_bitmap == 0U)) {
+		if (rcu_bitmap_root_ack(acked, this_cpu)) {
+			// Process the grace period completion on the current
+			// CPU.
+			reschedule = rcu_bitmap_notify();
+
+			// Trigger another quiesce on the current CPU.
+			ipi_one_relaxed(IPI_REASON_RCU_QUIESCE, this_cpu);
+		}
 	}
 
 	return reschedule;
@@ -371,11 +679,21 @@ rcu_bitmap_request_grace_period(rcu_cpu_state_t *my_state, count_t current_gen)
 {
 	assert_preempt_disabled();
 
+	// Make sure the CPU that starts our target period will look for us.
+	if (!my_state->is_waiting) {
+		cpu_index_t cpu	     = cpulocal_get_index();
+		my_state->is_waiting = true;
+		(void)atomic_fetch_or_explicit(
+			&rcu_leaves[rcu_bitmap_leaf_index(cpu)].waiting_cpus,
+			rcu_bitmap_leaf_cpu_bit(cpu), memory_order_relaxed);
+	}
+
 	// We need to wait for the next grace period (not the current one) to
 	// end, because we may have enqueued new updates during the current
 	// period. Therefore our target is the period after the next.
 	count_t target = current_gen + 2U;
 	atomic_store_relaxed(&my_state->target, target);
+	my_state->target_time = arch_get_timestamp();
 
 	// Update the max target period to be at least our new target.
 	count_t old_max_target = atomic_load_relaxed(&rcu_state.max_target);
@@ -411,6 +729,13 @@ rcu_bitmap_notify(void)
 		reschedule = rcu_bitmap_update();
 	}
 
+	// If the update stopped early, the ready batch is still non-empty, so
+	// we can't advance the batches yet. The update will notify again once
+	// the ready batch is empty.
+	if (my_state->ready_updates) {
+		goto out;
+	}
+
 	// Check whether the grace period we're currently waiting for (if any)
 	// has expired. The acquire here matches the release in
 	// rcu_bitmap_quiesce().
@@ -421,6 +746,17 @@ rcu_bitmap_notify(void)
 		goto out;
 	}
 
+	if (my_state->target_time != 0U) {
+		uint64_t wait_time =
+			arch_get_timestamp() - my_state->target_time;
+		my_state->target_time = 0U;
+
+		rcu_cpu_stats_t *stats = &my_state->stats;
+		rcu_bitmap_stat_add(&stats->grace_periods, 1U);
+		rcu_bitmap_stat_add(&stats->grace_period_time_total, wait_time);
+		rcu_bitmap_stat_max(&stats->grace_period_time_max, wait_time);
+	}
+
 	// Advance the batches
 	bool waiting_updates = false;
 	ENUM_FOREACH(RCU_UPDATE_CLASS, update_class)
@@ -447,6 +783,9 @@ rcu_bitmap_notify(void)
 		my_state->waiting_batch.heads[update_class] = next_head;
 		my_state->ready_batch.heads[update_class]   = waiting_head;
 	}
+	my_state->ready_batch.start_time   = my_state->waiting_batch.start_time;
+	my_state->waiting_batch.start_time = my_state->next_batch.start_time;
+	my_state->next_batch.start_time	   = 0U;
 
 	// Request processing of updates if any are ready
 	if (my_state->ready_updates) {
@@ -471,8 +810,10 @@ out:
 bool
 rcu_bitmap_update(void)
 {
-	// Call all the callbacks queued in the previous grace period
+	// Call the callbacks queued in the previous grace period, up to the
+	// batch size limit.
 	count_t		 update_count = 0;
+	bool		 remaining    = false;
 	rcu_cpu_state_t *my_state     = &CPULOCAL(rcu_state);
 
 	rcu_update_status_t status = rcu_update_status_default();
@@ -481,12 +822,16 @@ rcu_bitmap_update(void)
 		goto out;
 	}
 
+	uint64_t latency =
+		arch_get_timestamp() - my_state->ready_batch.start_time;
+
 	ENUM_FOREACH(RCU_UPDATE_CLASS, update_class)
 	{
 		rcu_entry_t *entry = my_state->ready_batch.heads[update_class];
-		my_state->ready_batch.heads[update_class] = NULL;
+		count_t	     class_count = 0U;
 
-		while (entry != NULL) {
+		while ((entry != NULL) &&
+		       (update_count < RCU_UPDATE_BATCH_SIZE)) {
 			// We must read the next pointer _before_ triggering
 			// the update, in case the update handler frees the
 			// object.
@@ -498,22 +843,95 @@ rcu_bitmap_update(void)
 				   status);
 			entry = next;
 			update_count++;
+			class_count++;
+		}
+
+		my_state->ready_batch.heads[update_class] = entry;
+		if (entry != NULL) {
+			remaining = true;
+		}
+
+		if (class_count != 0U) {
+			rcu_class_stats_t *stats =
+				&my_state->stats.classes[update_class];
+			rcu_bitmap_stat_add(&stats->processed, class_count);
+			rcu_bitmap_stat_add(&stats->latency_total,
+					    latency * class_count);
+			rcu_bitmap_stat_max(&stats->latency_max, latency);
 		}
 	}
 
 	if ((update_count != 0U) &&
 	    (atomic_fetch_sub_explicit(&my_state->update_count, update_count,
 				       memory_order_relaxed) == update_count)) {
+		if (my_state->is_waiting) {
+			cpu_index_t cpu	     = cpulocal_get_index();
+			my_state->is_waiting = false;
+			(void)atomic_fetch_and_explicit(
+				&rcu_leaves[rcu_bitmap_leaf_index(cpu)]
+					 .waiting_cpus,
+				~rcu_bitmap_leaf_cpu_bit(cpu),
+				memory_order_relaxed);
+		}
 		(void)atomic_fetch_sub_explicit(&rcu_state.waiter_count, 1U,
 						memory_order_relaxed);
 	}
 
-	my_state->ready_updates = false;
+	if (remaining) {
+		// Let the scheduler run before continuing; the rest of the
+		// batch will be processed by rcu_bitmap_continue_update().
+		rcu_bitmap_stat_add(&my_state->stats.deferred_batches, 1U);
+		my_state->update_deferred = true;
+		rcu_update_status_set_need_schedule(&status, true);
+	} else {
+		my_state->ready_updates = false;
+
+		if (my_state->update_deferred) {
+			// rcu_bitmap_notify() may have been skipped while the
+			// batch was being processed, so run it again.
+			my_state->update_deferred = false;
+			ipi_one_relaxed(IPI_REASON_RCU_NOTIFY,
+					cpulocal_get_index());
+		}
+	}
 
 out:
 	return rcu_update_status_get_need_schedule(&status);
 }
 
+void
+rcu_expedite_start(void)
+{
+	(void)atomic_fetch_add_explicit(&rcu_state.expedite_count, 1U,
+					memory_order_relaxed);
+	(void)atomic_fetch_add_explicit(&rcu_state.stats.expedited_syncs, 1U,
+					memory_order_relaxed);
+
+	// Fence to ensure that either the count is seen by the CPU that starts
+	// the next grace period, or we see that period below. This matches the
+	// fences in rcu_bitmap_root_ack() after a new grace period starts.
+	atomic_thread_fence(memory_order_seq_cst);
+
+	// The grace period in progress, if any, must end before the one the
+	// caller waits for can start, so expedite it too.
+	preempt_disable();
+	rcu_grace_period_t current_period =
+		atomic_load_relaxed(&rcu_state.current_period);
+	if (current_period.cpu_bitmap != 0U) {
+		rcu_bitmap_force_quiesce(current_period.cpu_bitmap,
+					 cpulocal_get_index());
+	}
+	preempt_enable();
+}
+
+void
+rcu_expedite_finish(void)
+{
+	count_t old_count = atomic_fetch_sub_explicit(
+		&rcu_state.expedite_count, 1U, memory_order_relaxed);
+	assert(old_count != 0U);
+}
+
 void
 rcu_bitmap_handle_power_cpu_offline(void)
 {
@@ -535,3 +953,82 @@ rcu_has_pending_updates(void)
 	return compiler_unexpected(rcu_bitmap_should_run()) &&
 	       (atomic_load_relaxed(&CPULOCAL(rcu_state).update_count) != 0U);
 }
+
+hypercall_rcu_get_stats_result_t
+hypercall_rcu_get_stats(cpu_index_t cpu, rcu_stat_t stat, index_t index)
+{
+	hypercall_rcu_get_stats_result_t ret = { 0 };
+
+	// Only privileged VMs (i.e. the root VM) may read the statistics.
+	if (!partition_option_flags_get_privileged(
+		    &thread_get_self()->header.partition->options)) {
+		ret.error = ERROR_DENIED;
+		goto out;
+	}
+
+	if (!cpulocal_index_valid(cpu)) {
+		ret.error = ERROR_ARGUMENT_INVALID;
+		goto out;
+	}
+
+	rcu_cpu_stats_t *stats = &CPULOCAL_BY_INDEX(rcu_state, cpu).stats;
+
+	// The index selects the update class for the class_ statistics, and
+	// must be zero for all others.
+	bool	class_stat = (stat >= RCU_STAT_CLASS_ENQUEUED) &&
+			     (stat <= RCU_STAT_CLASS_LATENCY_MAX);
+	index_t max_index  = class_stat ? (index_t)RCU_UPDATE_CLASS__MAX : 0U;
+	if (index > max_index) {
+		ret.error = ERROR_ARGUMENT_INVALID;
+		goto out;
+	}
+
+	rcu_class_stats_t *class_stats = &stats->classes[index];
+
+	// All statistics are updated with relaxed atomics, so no locks are
+	// needed to read them.
+	ret.error = OK;
+	switch (stat) {
+	case RCU_STAT_GRACE_PERIODS:
+		ret.value = atomic_load_relaxed(&stats->grace_periods);
+		break;
+	case RCU_STAT_GRACE_PERIOD_TIME_TOTAL:
+		ret.value = atomic_load_relaxed(&stats->grace_period_time_total);
+		break;
+	case RCU_STAT_GRACE_PERIOD_TIME_MAX:
+		ret.value = atomic_load_relaxed(&stats->grace_period_time_max);
+		break;
+	case RCU_STAT_DEFERRED_BATCHES:
+		ret.value = atomic_load_relaxed(&stats->deferred_batches);
+		break;
+	case RCU_STAT_CLASS_ENQUEUED:
+		ret.value = atomic_load_relaxed(&class_stats->enqueued);
+		break;
+	case RCU_STAT_CLASS_PROCESSED:
+		ret.value = atomic_load_relaxed(&class_stats->processed);
+		break;
+	case RCU_STAT_CLASS_LATENCY_TOTAL:
+		ret.value = atomic_load_relaxed(&class_stats->latency_total);
+		break;
+	case RCU_STAT_CLASS_LATENCY_MAX:
+		ret.value = atomic_load_relaxed(&class_stats->latency_max);
+		break;
+	case RCU_STAT_EXPEDITED_SYNCS:
+		ret.value =
+			atomic_load_relaxed(&rcu_state.stats.expedited_syncs);
+		break;
+	case RCU_STAT_EXPEDITED_PERIODS:
+		ret.value =
+			atomic_load_relaxed(&rcu_state.stats.expedited_periods);
+		break;
+	case RCU_STAT_EXPEDITE_IPIS:
+		ret.value = atomic_load_relaxed(&rcu_state.stats.expedite_ipis);
+		break;
+	default:
+		ret.error = ERROR_ARGUMENT_INVALID;
+		break;
+	}
+
+out:
+	return ret;
+}
@@ -56,6 +56,14 @@ rcu_sync(void)
 	scheduler_unlock(thread);
 }
 
+void
+rcu_sync_expedited(void)
+{
+	rcu_expedite_start();
+	rcu_sync();
+	rcu_expedite_finish();
+}
+
 bool
 rcu_sync_killable(void)
 {
@@ -0,0 +1,27 @@
+// © 2021 Qualcomm Innovation Center, Inc. All rights reserved.
+//
+// SPDX-License-Identifier: BSD-3-Clause
+
+#ifdef __EVENTS_DSL__
+#define require_rwlock_read(lock)                                              \
+	require_preempt_disabled;                                              \
+	require_read(lock)
+#define require_rwlock_write(lock)                                             \
+	require_preempt_disabled;                                              \
+	require_lock(lock)
+#else
+#define ACQUIRE_RWLOCK_READ(lock) ACQUIRE_READ(lock) ACQUIRE_PREEMPT_DISABLED
+#define ACQUIRE_RWLOCK_READ_NP(lock)                                           \
+	ACQUIRE_READ(lock) REQUIRE_PREEMPT_DISABLED
+#define RELEASE_RWLOCK_READ(lock) RELEASE_READ(lock) RELEASE_PREEMPT_DISABLED
+#define RELEASE_RWLOCK_READ_NP(lock)                                           \
+	RELEASE_READ(lock) REQUIRE_PREEMPT_DISABLED
+#define REQUIRE_RWLOCK_READ(lock) REQUIRE_READ(lock) REQUIRE_PREEMPT_DISABLED
+#define ACQUIRE_RWLOCK_WRITE(lock) ACQUIRE_LOCK(lock) ACQUIRE_PREEMPT_DISABLED
+#define ACQUIRE_RWLOCK_WRITE_NP(lock)                                          \
+	ACQUIRE_LOCK(lock) REQUIRE_PREEMPT_DISABLED
+#define RELEASE_RWLOCK_WRITE(lock) RELEASE_LOCK(lock) RELEASE_PREEMPT_DISABLED
+#define RELEASE_RWLOCK_WRITE_NP(lock)                                          \
+	RELEASE_LOCK(lock) REQUIRE_PREEMPT_DISABLED
+#define REQUIRE_RWLOCK_WRITE(lock) REQUIRE_LOCK(lock) REQUIRE_PREEMPT_DISABLED
+#endif
@@ -0,0 +1,134 @@
+// © 2021 Qualcomm Innovation Center, Inc. All rights reserved.
+//
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <hyptypes.h>
+
+#include <atomic.h>
+#include <compiler.h>
+#include <preempt.h>
+#include <rwlock.h>
+
+#include <asm/event.h>
+
+// Phase-fair ticket reader-writer lock implementation, after Brandenburg and
+// Anderson's PF-T lock.
+//
+// Readers and writers alternate in phases. A reader that arrives while a
+// writer is present waits only until that writer releases the lock, even if
+// more writers are queued behind it; a writer waits only for the readers that
+// arrived before it, and for earlier writers. Neither can be starved, and all
+// waiters poll with event-wait, as for ticket spinlocks.
+
+void
+rwlock_init(rwlock_t *lock)
+{
+	atomic_init(&lock->read_in, 0U);
+	atomic_init(&lock->read_out, 0U);
+	atomic_init(&lock->write_in, 0U);
+	atomic_init(&lock->write_out, 0U);
+}
+
+void
+rwlock_read_acquire(rwlock_t *lock)
+{
+	preempt_disable();
+	rwlock_read_acquire_nopreempt(lock);
+}
+
+void
+rwlock_read_acquire_nopreempt(rwlock_t *lock) LOCK_IMPL
+{
+	// Count ourselves in, and see whether a writer is present
+	uint32_t writer = atomic_fetch_add_explicit(&lock->read_in,
+						    RWLOCK_READER_INC,
+						    memory_order_acquire) &
+			  RWLOCK_WRITER_MASK;
+
+	if (compiler_unexpected(writer != 0U)) {
+		// Wait for the writer's phase to end. The next writer, if any,
+		// has the opposite phase bit, so this can't wait for it too.
+		while ((asm_event_load_before_wait(&lock->read_in) &
+			RWLOCK_WRITER_MASK) == writer) {
+			asm_event_wait(&lock->read_in);
+		}
+	}
+}
+
+void
+rwlock_read_release(rwlock_t *lock)
+{
+	rwlock_read_release_nopreempt(lock);
+	preempt_enable();
+}
+
+void
+rwlock_read_release_nopreempt(rwlock_t *lock) LOCK_IMPL
+{
+	// Count ourselves out; a waiting writer polls this
+	(void)atomic_fetch_add_explicit(&lock->read_out, RWLOCK_READER_INC,
+					memory_order_release);
+	asm_event_wake_updated();
+}
+
+void
+rwlock_write_acquire(rwlock_t *lock)
+{
+	preempt_disable();
+	rwlock_write_acquire_nopreempt(lock);
+}
+
+void
+rwlock_write_acquire_nopreempt(rwlock_t *lock) LOCK_IMPL
+{
+	// Take a ticket, and wait until it is being served
+	uint16_t ticket = atomic_fetch_add_explicit(&lock->write_in, 1U,
+						    memory_order_relaxed);
+	while (asm_event_load_before_wait(&lock->write_out) != ticket) {
+		asm_event_wait(&lock->write_out);
+	}
+
+	// Block new readers, then wait for the readers already present to
+	// leave. The reader count is in the top bits, and the writer bits
+	// were clear before this update.
+	uint32_t writer = RWLOCK_WRITER_PRESENT |
+			  ((uint32_t)ticket & RWLOCK_WRITER_PHASE);
+	uint32_t readers = atomic_fetch_add_explicit(&lock->read_in, writer,
+						     memory_order_relaxed);
+	while (asm_event_load_before_wait(&lock->read_out) != readers) {
+		asm_event_wait(&lock->read_out);
+	}
+}
+
+void
+rwlock_write_release(rwlock_t *lock)
+{
+	rwlock_write_release_nopreempt(lock);
+	preempt_enable();
+}
+
+void
+rwlock_write_release_nopreempt(rwlock_t *lock) LOCK_IMPL
+{
+	// Let the waiting readers in, then serve the next writer
+	(void)atomic_fetch_and_explicit(&lock->read_in, ~RWLOCK_WRITER_MASK,
+					memory_order_release);
+	asm_event_wake_updated();
+
+	uint16_t ticket = atomic_load_relaxed(&lock->write_out);
+	asm_event_store_and_wake(&lock->write_out, ticket + 1U);
+}
+
+void
+assert_rwlock_read_held(const rwlock_t *lock)
+{
+	(void)lock;
+	assert_preempt_disabled();
+}
+
+void
+assert_rwlock_write_held(const rwlock_t *lock)
+{
+	(void)lock;
+	assert_preempt_disabled();
+}
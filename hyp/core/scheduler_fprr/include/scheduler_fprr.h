@@ -0,0 +1,10 @@
+// © 2021 Qualcomm Innovation Center, Inc. All rights reserved.
+//
+// SPDX-License-Identifier: BSD-3-Clause
+
+// Read one of the scheduling statistics for a thread, or for a CPU if the
+// thread is NULL. For histograms, the index selects the bucket; otherwise it
+// must be zero.
+uint64_result_t
+scheduler_fprr_get_stats(thread_t *thread, cpu_index_t cpu,
+			 scheduler_stat_t stat, index_t index);
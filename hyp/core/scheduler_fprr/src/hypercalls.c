@@ -11,9 +11,12 @@
 #include <cspace.h>
 #include <cspace_lookup.h>
 #include <object.h>
+#include <partition.h>
 #include <scheduler.h>
 #include <thread.h>
 
+#include "scheduler_fprr.h"
+
 error_t
 hypercall_scheduler_yield(scheduler_yield_control_t control, register_t arg1)
 {
@@ -58,3 +61,56 @@ hypercall_scheduler_yield(scheduler_yield_control_t control, register_t arg1)
 out:
 	return ret;
 }
+
+hypercall_scheduler_get_stats_result_t
+hypercall_scheduler_get_stats(cap_id_t thread_cap, cpu_index_t cpu,
+			      scheduler_stat_t stat, index_t index)
+{
+	hypercall_scheduler_get_stats_result_t ret = { 0 };
+
+	// Only privileged VMs (i.e. the root VM) may read the statistics.
+	if (!partition_option_flags_get_privileged(
+		    &thread_get_self()->header.partition->options)) {
+		ret.error = ERROR_DENIED;
+		goto out;
+	}
+
+	uint64_result_t result;
+	if (thread_cap == CSPACE_CAP_INVALID) {
+		result = scheduler_fprr_get_stats(NULL, cpu, stat, index);
+	} else {
+		thread_ptr_result_t thread_r = cspace_lookup_thread_any(
+			cspace_get_self(), thread_cap,
+			CAP_RIGHTS_THREAD_SCHED_STATS);
+		if (compiler_unexpected(thread_r.e != OK)) {
+			ret.error = thread_r.e;
+			goto out;
+		}
+
+		result = scheduler_fprr_get_stats(thread_r.r, CPU_INDEX_INVALID,
+						  stat, index);
+		object_put_thread(thread_r.r);
+	}
+
+	ret.error = result.e;
+	ret.value = result.r;
+out:
+	return ret;
+}
+
+error_t
+hypercall_scheduler_set_cpu_isolation(cpu_index_t cpu, bool isolated)
+{
+	error_t ret;
+
+	// Only privileged VMs (i.e. the root VM) may isolate CPUs.
+	if (!partition_option_flags_get_privileged(
+		    &thread_get_self()->header.partition->options)) {
+		ret = ERROR_DENIED;
+		goto out;
+	}
+
+	ret = scheduler_set_cpu_isolated(cpu, isolated);
+out:
+	return ret;
+}
@@ -18,6 +18,7 @@
 #include <list.h>
 #include <object.h>
 #include <panic.h>
+#include <platform_cpu.h>
 #include <preempt.h>
 #include <rcu.h>
 #include <scheduler.h>
@@ -25,6 +26,7 @@
 #include <thread.h>
 #include <timer_queue.h>
 #include <trace.h>
+#include <util.h>
 #if defined(INTERFACE_VCPU)
 #include <vcpu.h>
 #endif
@@ -34,6 +36,7 @@
 #include <asm/event.h>
 
 #include "event_handlers.h"
+#include "scheduler_fprr.h"
 
 CPULOCAL_DECLARE_STATIC(scheduler_t, scheduler);
 CPULOCAL_DECLARE_STATIC(thread_t *_Atomic, primary_thread);
@@ -42,6 +45,19 @@ CPULOCAL_DECLARE_STATIC(thread_t *, yielded_from);
 
 static BITMAP_DECLARE(SCHEDULER_NUM_BLOCK_BITS, non_killable_block_mask);
 
+// Lowest-numbered CPU in each CPU's cluster, used to identify the cluster.
+static cpu_index_t scheduler_cpu_cluster[PLATFORM_MAX_CORES];
+
+// CPUs in isolated mode. Changes are serialised by the isolation lock.
+static _Atomic BITMAP_DECLARE(PLATFORM_MAX_CORES, scheduler_isolated_cpus);
+static spinlock_t scheduler_isolation_lock;
+
+#if defined(SCHEDULER_FPRR_LOAD_BALANCE) && defined(INTERFACE_VCPU)
+// CPUs that are running their idle threads, and may pull runnable threads
+// from the runqueues of busy CPUs.
+static _Atomic BITMAP_DECLARE(PLATFORM_MAX_CORES, scheduler_idle_cpus);
+#endif
+
 static_assert((SCHEDULER_DEFAULT_PRIORITY >= SCHEDULER_MIN_PRIORITY) &&
 		      (SCHEDULER_DEFAULT_PRIORITY <= SCHEDULER_MAX_PRIORITY),
 	      "Default priority is invalid.");
@@ -69,6 +85,200 @@ reset_sched_params(thread_t *target)
 	target->scheduler_active_timeslice = target->scheduler_base_timeslice;
 }
 
+// Returns the priority a thread is queued and scheduled at, including any
+// interrupt wakeup boost or inherited priority. These only change while the
+// thread is not in a runqueue.
+static priority_t
+get_priority(const thread_t *thread)
+{
+	priority_t prio = thread->scheduler_priority;
+
+	if (compiler_unexpected(thread->scheduler_boost != 0U) &&
+	    (prio < SCHEDULER_MAX_BOOSTED_PRIORITY)) {
+		prio = util_min(prio + thread->scheduler_boost,
+				SCHEDULER_MAX_BOOSTED_PRIORITY);
+	}
+
+	return util_max(prio, thread->scheduler_inherited_priority);
+}
+
+// Called when a boosted thread has used its whole timeslice. The thread must
+// be the active thread of its CPU, with that CPU's scheduler lock held.
+static void
+expire_irq_boost(thread_t *target)
+{
+	if (target->scheduler_boost != 0U) {
+		target->scheduler_boost = 0U;
+		if ((target->scheduler_irq_boost >>
+		     target->scheduler_boost_shift) != 0U) {
+			target->scheduler_boost_shift++;
+		}
+		atomic_store_relaxed(
+			&target->scheduler_irq_boosts_expired,
+			atomic_load_relaxed(
+				&target->scheduler_irq_boosts_expired) +
+				1U);
+	}
+}
+
+#if defined(SCHEDULER_FPRR_LATENCY_STATS)
+static void
+stats_count(_Atomic count_t *count)
+{
+	// Each counter has a single writer, so an atomic RMW is not needed.
+	atomic_store_relaxed(count, atomic_load_relaxed(count) + 1U);
+}
+
+static index_t
+stats_get_bucket(ticks_t ticks)
+{
+	nanoseconds_t ns     = timer_convert_ticks_to_ns(ticks);
+	index_t	      bucket = (ns == 0U) ? 0U : compiler_msb(ns);
+
+	return util_min(bucket, SCHEDULER_STATS_NUM_BUCKETS - 1U);
+}
+
+static void
+stats_record_latency(_Atomic count_t *hist, ticks_t ticks)
+{
+	stats_count(&hist[stats_get_bucket(ticks)]);
+}
+
+static void
+stats_migration_done(thread_t *thread) REQUIRE_SCHEDULER_LOCK(thread)
+{
+	ticks_t latency = timer_get_current_timer_ticks() -
+			  thread->scheduler_stats_migrate_time;
+	stats_record_latency(thread->scheduler_stats.migrate, latency);
+
+	// Migrations to a CPU may complete on any CPU, so its histogram has
+	// multiple writers.
+	cpu_index_t cpu = thread->scheduler_affinity;
+	if (cpulocal_index_valid(cpu)) {
+		scheduler_t *scheduler = &CPULOCAL_BY_INDEX(scheduler, cpu);
+		(void)atomic_fetch_add_explicit(
+			&scheduler->stats.migrate[stats_get_bucket(latency)],
+			1U, memory_order_relaxed);
+	}
+}
+
+static void
+stats_thread_selected(scheduler_t *scheduler, thread_t *target,
+		      ticks_t curticks) REQUIRE_SPINLOCK(scheduler->lock)
+{
+	ticks_t wait = curticks - target->scheduler_stats_enqueue_time;
+	stats_record_latency(target->scheduler_stats.wait, wait);
+	stats_record_latency(scheduler->stats.wait, wait);
+
+	if (target->scheduler_stats_woken) {
+		target->scheduler_stats_woken = false;
+
+		ticks_t latency = curticks - target->scheduler_stats_wakeup_time;
+		stats_record_latency(target->scheduler_stats.wakeup, latency);
+		stats_record_latency(scheduler->stats.wakeup, latency);
+	}
+}
+#endif
+
+static bool
+is_deadline_thread(const thread_t *thread)
+{
+	return thread->scheduler_deadline_period != 0U;
+}
+
+static bool
+has_deadline_budget(const thread_t *thread)
+{
+	return is_deadline_thread(thread) &&
+	       (thread->scheduler_deadline_remaining != 0U);
+}
+
+static bool
+is_deadline_a_before_b(list_node_t *node_a, list_node_t *node_b)
+{
+	thread_t *a = thread_container_of_scheduler_list_node(node_a);
+	thread_t *b = thread_container_of_scheduler_list_node(node_b);
+
+	return a->scheduler_deadline_absolute < b->scheduler_deadline_absolute;
+}
+
+static bool
+replenish_deadline(thread_t *target, ticks_t curticks)
+{
+	assert(target != NULL);
+
+	bool replenished = false;
+
+	// Start a new period once the previous one has ended. The new period
+	// starts now rather than at the end of the previous one, so a thread
+	// can't accumulate budget while it is blocked.
+	if (is_deadline_thread(target) &&
+	    (curticks >= target->scheduler_deadline_release)) {
+		target->scheduler_deadline_remaining =
+			target->scheduler_deadline_budget;
+		target->scheduler_deadline_absolute =
+			curticks + target->scheduler_deadline_relative;
+		target->scheduler_deadline_release =
+			curticks + target->scheduler_deadline_period;
+		replenished = true;
+	}
+
+	return replenished;
+}
+
+static void
+update_deadline_budget(scheduler_t *scheduler, thread_t *target,
+		       ticks_t curticks) REQUIRE_PREEMPT_DISABLED
+{
+	assert(scheduler != NULL);
+	assert(target != NULL);
+
+	if (has_deadline_budget(target)) {
+		// Account for the time the target has used.
+		ticks_t used	  = curticks - scheduler->schedtime;
+		ticks_t remaining = target->scheduler_deadline_remaining;
+
+		target->scheduler_deadline_remaining =
+			(used < remaining) ? (remaining - used) : 0U;
+	}
+}
+
+static bool
+has_quota(const thread_t *thread)
+{
+	return thread->scheduler_quota_period != 0U;
+}
+
+static void
+replenish_quota(thread_t *thread, ticks_t curticks)
+	REQUIRE_SCHEDULER_LOCK(thread)
+{
+	assert_spinlock_held(&thread->scheduler_lock);
+
+	// As for deadline threads, the new period starts now, so a thread
+	// can't accumulate budget while it is blocked or waiting.
+	thread->scheduler_quota_remaining = thread->scheduler_quota_budget;
+	thread->scheduler_quota_release =
+		curticks + thread->scheduler_quota_period;
+}
+
+static void
+charge_quota(thread_t *thread, ticks_t curticks) REQUIRE_SCHEDULER_LOCK(thread)
+{
+	assert_spinlock_held(&thread->scheduler_lock);
+
+	ticks_t used	  = curticks - thread->scheduler_quota_start;
+	ticks_t remaining = thread->scheduler_quota_remaining;
+
+	thread->scheduler_quota_remaining =
+		(used < remaining) ? (remaining - used) : 0U;
+	thread->scheduler_quota_start = curticks;
+
+	atomic_store_relaxed(&thread->scheduler_quota_used,
+			     atomic_load_relaxed(&thread->scheduler_quota_used) +
+				     used);
+}
+
 static void
 set_yield_to(thread_t *target, thread_t *yield_to)
 {
@@ -111,6 +321,7 @@ update_timeslice(scheduler_t *scheduler, thread_t *target, ticks_t curticks)
 	if (expired) {
 		reset_sched_params(target);
 		end_directed_yield(target);
+		expire_irq_boost(target);
 	} else {
 		// Account for the time the target has used.
 		target->scheduler_active_timeslice = timeout - curticks;
@@ -126,21 +337,41 @@ add_to_runqueue(scheduler_t *scheduler, thread_t *target, bool at_tail)
 	assert_preempt_disabled();
 	assert_spinlock_held(&scheduler->lock);
 
-	index_t i	  = SCHEDULER_MAX_PRIORITY - target->scheduler_priority;
-	list_t *list	  = &scheduler->runqueue[i];
-	bool	was_empty = list_is_empty(list);
+	if (has_deadline_budget(target)) {
+		(void)list_insert_in_order(&scheduler->deadline_queue,
+					   &target->scheduler_list_node,
+					   is_deadline_a_before_b);
+		target->scheduler_deadline_queued = true;
+	} else {
+		index_t i = SCHEDULER_MAX_PRIORITY - get_priority(target);
+		list_t *list	  = &scheduler->runqueue[i];
+		bool	was_empty = list_is_empty(list);
 
-	assert(was_empty || bitmap_isset(scheduler->prio_bitmap, i));
+		assert(was_empty || bitmap_isset(scheduler->prio_bitmap, i));
 
-	if (at_tail) {
-		list_insert_at_tail(list, &target->scheduler_list_node);
-	} else {
-		list_insert_at_head(list, &target->scheduler_list_node);
-	}
+		if (at_tail) {
+			list_insert_at_tail(list, &target->scheduler_list_node);
+		} else {
+			list_insert_at_head(list, &target->scheduler_list_node);
+		}
+
+		if (was_empty) {
+			bitmap_set(scheduler->prio_bitmap, i);
+		}
 
-	if (was_empty) {
-		bitmap_set(scheduler->prio_bitmap, i);
+		if (is_deadline_thread(target)) {
+			// Run at the thread's priority until the budget is
+			// replenished.
+			list_insert_at_tail(&scheduler->deadline_throttled,
+					    &target->scheduler_deadline_node);
+		}
 	}
+
+	atomic_store_relaxed(&scheduler->queued_count,
+			     atomic_load_relaxed(&scheduler->queued_count) + 1U);
+#if defined(SCHEDULER_FPRR_LATENCY_STATS)
+	target->scheduler_stats_enqueue_time = timer_get_current_timer_ticks();
+#endif
 }
 
 static void
@@ -149,16 +380,51 @@ remove_from_runqueue(scheduler_t *scheduler, thread_t *target)
 {
 	assert_preempt_disabled();
 
-	index_t	     i	  = SCHEDULER_MAX_PRIORITY - target->scheduler_priority;
-	list_t	    *list = &scheduler->runqueue[i];
 	list_node_t *node = &target->scheduler_list_node;
-	bool	     was_head = node == list_get_head(list);
 
-	assert(bitmap_isset(scheduler->prio_bitmap, i));
+	if (target->scheduler_deadline_queued) {
+		(void)list_delete_node(&scheduler->deadline_queue, node);
+		target->scheduler_deadline_queued = false;
+	} else {
+		index_t i = SCHEDULER_MAX_PRIORITY - get_priority(target);
+		list_t *list	 = &scheduler->runqueue[i];
+		bool	was_head = node == list_get_head(list);
+
+		assert(bitmap_isset(scheduler->prio_bitmap, i));
+
+		if (!list_delete_node(list, node) && was_head) {
+			assert(list_is_empty(list));
+			bitmap_clear(scheduler->prio_bitmap, i);
+		}
+
+		if (is_deadline_thread(target)) {
+			(void)list_delete_node(
+				&scheduler->deadline_throttled,
+				&target->scheduler_deadline_node);
+		}
+	}
+
+	if (scheduler->gang_thread == target) {
+		scheduler->gang_thread = NULL;
+	}
+
+	count_t queued = atomic_load_relaxed(&scheduler->queued_count);
+	assert(queued > 0U);
+	atomic_store_relaxed(&scheduler->queued_count, queued - 1U);
+}
+
+static void
+set_active_thread(scheduler_t *scheduler, thread_t *thread)
+	REQUIRE_SPINLOCK(scheduler->lock)
+{
+	bool active = thread != NULL;
+
+	scheduler->active_thread = thread;
 
-	if (!list_delete_node(list, node) && was_head) {
-		assert(list_is_empty(list));
-		bitmap_clear(scheduler->prio_bitmap, i);
+	// Avoid writing the flag unless it has changed, since remote CPUs
+	// may be reading it.
+	if (atomic_load_relaxed(&scheduler->active) != active) {
+		atomic_store_relaxed(&scheduler->active, active);
 	}
 }
 
@@ -176,12 +442,117 @@ pop_runqueue_head(scheduler_t *scheduler, index_t i)
 	assert(node != NULL);
 
 	thread_t *head = thread_container_of_scheduler_list_node(node);
-	assert(head->scheduler_priority == (SCHEDULER_MAX_PRIORITY - i));
+	assert(get_priority(head) == (SCHEDULER_MAX_PRIORITY - i));
 	remove_from_runqueue(scheduler, head);
 
 	return head;
 }
 
+static thread_t *
+get_deadline_head(scheduler_t *scheduler) REQUIRE_SPINLOCK(scheduler->lock)
+{
+	list_node_t *node = list_get_head(&scheduler->deadline_queue);
+
+	return (node != NULL) ? thread_container_of_scheduler_list_node(node)
+			      : NULL;
+}
+
+static thread_t *
+get_gang_head(scheduler_t *scheduler, const thread_t *target)
+	REQUIRE_SPINLOCK(scheduler->lock)
+{
+	thread_t *gang = scheduler->gang_thread;
+	index_t	  i;
+
+	if (gang != NULL) {
+		// The hint only applies to one scheduling decision.
+		scheduler->gang_thread = NULL;
+
+		// The gang thread may run ahead of other threads with the same
+		// priority, but not ahead of higher-priority threads.
+		if (((target != NULL) &&
+		     (get_priority(target) > get_priority(gang))) ||
+		    (bitmap_ffs(scheduler->prio_bitmap, SCHEDULER_NUM_PRIORITIES,
+				&i) &&
+		     ((SCHEDULER_MAX_PRIORITY - i) > get_priority(gang)))) {
+			gang = NULL;
+		}
+	}
+
+	return gang;
+}
+
+static bool
+runqueue_is_empty(scheduler_t *scheduler) REQUIRE_SPINLOCK(scheduler->lock)
+{
+	return bitmap_empty(scheduler->prio_bitmap,
+			    SCHEDULER_NUM_PRIORITIES) &&
+	       list_is_empty(&scheduler->deadline_queue);
+}
+
+static void
+replenish_throttled(scheduler_t *scheduler, ticks_t curticks)
+	REQUIRE_SPINLOCK(scheduler->lock)
+{
+	assert_spinlock_held(&scheduler->lock);
+
+	thread_t *thread;
+
+	// Move threads whose budget has been replenished from the priority
+	// runqueues to the deadline queue.
+	list_foreach_container_maydelete (thread,
+					  &scheduler->deadline_throttled,
+					  thread, scheduler_deadline_node) {
+		if (curticks >= thread->scheduler_deadline_release) {
+			remove_from_runqueue(scheduler, thread);
+			(void)replenish_deadline(thread, curticks);
+			add_to_runqueue(scheduler, thread, true);
+		}
+	}
+}
+
+static bool
+deadline_admit(cpu_index_t cpu, uint32_t old_bw, uint32_t new_bw)
+{
+	scheduler_t *scheduler = &CPULOCAL_BY_INDEX(scheduler, cpu);
+	bool	     admitted;
+
+	spinlock_acquire_nopreempt(&scheduler->lock);
+	assert(scheduler->deadline_bw >= old_bw);
+	uint32_t others = scheduler->deadline_bw - old_bw;
+	admitted	= new_bw <= (SCHEDULER_MAX_DEADLINE_BW - others);
+	if (admitted) {
+		scheduler->deadline_bw = others + new_bw;
+	}
+	spinlock_release_nopreempt(&scheduler->lock);
+
+	return admitted;
+}
+
+static void
+deadline_release(cpu_index_t cpu, uint32_t bw)
+{
+	scheduler_t *scheduler = &CPULOCAL_BY_INDEX(scheduler, cpu);
+
+	spinlock_acquire_nopreempt(&scheduler->lock);
+	assert(scheduler->deadline_bw >= bw);
+	scheduler->deadline_bw -= bw;
+	spinlock_release_nopreempt(&scheduler->lock);
+}
+
+static void
+release_deadline_reservation(thread_t *thread) REQUIRE_SCHEDULER_LOCK(thread)
+{
+	assert_spinlock_held(&thread->scheduler_lock);
+
+	if (sched_state_get_deadline_reserved(&thread->scheduler_state)) {
+		deadline_release(thread->scheduler_affinity,
+				 thread->scheduler_deadline_bw);
+		sched_state_set_deadline_reserved(&thread->scheduler_state,
+						  false);
+	}
+}
+
 static bool
 can_be_scheduled(const thread_t *thread) REQUIRE_SCHEDULER_LOCK(thread)
 {
@@ -197,13 +568,68 @@ can_be_scheduled(const thread_t *thread) REQUIRE_SCHEDULER_LOCK(thread)
 	return bitmap_empty(&block_bits, SCHEDULER_NUM_BLOCK_BITS);
 }
 
+#if defined(ARCH_ARM)
+static MPIDR_EL1_t
+get_cluster_mpidr(cpu_index_t cpu)
+{
+	MPIDR_EL1_t mpidr = platform_cpu_index_to_mpidr(cpu);
+
+	// The lowest affinity level identifies the core within its cluster;
+	// for multi-threaded cores it identifies the thread, and the next
+	// level identifies the core.
+	MPIDR_EL1_set_Aff0(&mpidr, 0U);
+	if (MPIDR_EL1_get_MT(&mpidr)) {
+		MPIDR_EL1_set_Aff1(&mpidr, 0U);
+	}
+
+	return mpidr;
+}
+#endif
+
+static void
+init_cpu_clusters(void)
+{
+	for (cpu_index_t i = 0U; i < PLATFORM_MAX_CORES; i++) {
+#if defined(ARCH_ARM)
+		MPIDR_EL1_t cluster = get_cluster_mpidr(i);
+
+		scheduler_cpu_cluster[i] = i;
+		for (cpu_index_t j = 0U; j < i; j++) {
+			if (MPIDR_EL1_is_equal(get_cluster_mpidr(j), cluster)) {
+				scheduler_cpu_cluster[i] = scheduler_cpu_cluster[j];
+				break;
+			}
+		}
+#else
+		scheduler_cpu_cluster[i] = 0U;
+#endif
+	}
+}
+
+static bool
+cpus_share_cluster(cpu_index_t a, cpu_index_t b)
+{
+	assert(cpulocal_index_valid(a) && cpulocal_index_valid(b));
+
+	return scheduler_cpu_cluster[a] == scheduler_cpu_cluster[b];
+}
+
 void
 scheduler_fprr_handle_boot_cold_init(void)
 {
+	init_cpu_clusters();
+	spinlock_init(&scheduler_isolation_lock);
+
 	for (cpu_index_t i = 0U; i < PLATFORM_MAX_CORES; i++) {
 		scheduler_t *scheduler = &CPULOCAL_BY_INDEX(scheduler, i);
 		spinlock_init(&scheduler->lock);
 		timer_init_object(&scheduler->timer, TIMER_ACTION_RESCHEDULE);
+		list_init(&scheduler->deadline_queue);
+		list_init(&scheduler->deadline_throttled);
+		atomic_init(&scheduler->wakeup_list, NULL);
+		atomic_init(&scheduler->wakeup_kicked, false);
+		atomic_init(&scheduler->wakeup_priority,
+			    SCHEDULER_MIN_PRIORITY);
 		for (index_t j = 0U; j < SCHEDULER_NUM_PRIORITIES; j++) {
 			list_init(&scheduler->runqueue[j]);
 		}
@@ -254,6 +680,9 @@ scheduler_fprr_handle_object_create_thread(thread_create_t thread_create)
 	       (timeslice >= SCHEDULER_MIN_TIMESLICE));
 	thread->scheduler_base_timeslice = timer_convert_ns_to_ticks(timeslice);
 
+	timer_init_object(&thread->scheduler_quota_timer,
+			  TIMER_ACTION_SCHEDULER_QUOTA);
+
 	sched_state_set_init(&thread->scheduler_state, true);
 
 	return OK;
@@ -337,6 +766,24 @@ scheduler_fprr_handle_vcpu_wakeup(thread_t *thread)
 	assert_spinlock_held(&thread->scheduler_lock);
 	assert(thread->kind == THREAD_KIND_VCPU);
 
+	// Boost a VCPU woken from WFI by a virtual interrupt, so it doesn't
+	// wait behind CPU-bound threads of the same priority. The boost can
+	// only change while the thread is not queued.
+	if ((thread->scheduler_irq_boost != 0U) &&
+	    !sched_state_get_queued(&thread->scheduler_state) &&
+	    scheduler_is_blocked(thread, SCHEDULER_BLOCK_VCPU_WFI)) {
+		priority_t boost = thread->scheduler_irq_boost >>
+				   thread->scheduler_boost_shift;
+		if (boost != 0U) {
+			thread->scheduler_boost = boost;
+			atomic_store_relaxed(
+				&thread->scheduler_irq_boosts,
+				atomic_load_relaxed(
+					&thread->scheduler_irq_boosts) +
+					1U);
+		}
+	}
+
 	bool was_yielding = atomic_exchange_explicit(
 		&thread->scheduler_yielding, false, memory_order_relaxed);
 	if (compiler_unexpected(was_yielding)) {
@@ -380,6 +827,10 @@ scheduler_fprr_handle_object_deactivate_thread(thread_t *thread)
 {
 	assert(thread != NULL);
 
+	// The quota timer may still be queued if the thread was killed while
+	// throttled.
+	timer_dequeue(&thread->scheduler_quota_timer);
+
 	if (cpulocal_index_valid(thread->scheduler_affinity)) {
 		thread_t *_Atomic *primary_thread_p = &CPULOCAL_BY_INDEX(
 			primary_thread, thread->scheduler_affinity);
@@ -389,9 +840,26 @@ scheduler_fprr_handle_object_deactivate_thread(thread_t *thread)
 	}
 }
 
+void
+scheduler_fprr_handle_object_cleanup_thread(thread_t *thread)
+{
+	assert(thread != NULL);
+
+	scheduler_lock(thread);
+	release_deadline_reservation(thread);
+	scheduler_unlock(thread);
+}
+
+static bool
+drain_remote_wakeups(void) REQUIRE_PREEMPT_DISABLED;
+
 bool
 scheduler_fprr_handle_ipi_reschedule(void)
 {
+	// Always reschedule; this IPI is also sent for reasons other than
+	// remote wakeups.
+	(void)drain_remote_wakeups();
+
 	return true;
 }
 
@@ -405,6 +873,61 @@ scheduler_fprr_handle_timer_reschedule(void)
 	return true;
 }
 
+bool
+scheduler_fprr_handle_timer_quota(timer_t *timer)
+{
+	assert_preempt_disabled();
+
+	thread_t *thread = thread_container_of_scheduler_quota_timer(timer);
+	ticks_t	  curticks	= timer_get_current_timer_ticks();
+	bool	  need_schedule = false;
+
+	scheduler_lock_nopreempt(thread);
+
+	if (scheduler_is_blocked(thread, SCHEDULER_BLOCK_QUOTA_THROTTLED)) {
+		// The throttled period has ended.
+		replenish_quota(thread, curticks);
+		need_schedule = scheduler_unblock(
+			thread, SCHEDULER_BLOCK_QUOTA_THROTTLED);
+	} else if (sched_state_get_running(&thread->scheduler_state) &&
+		   (atomic_load_relaxed(&thread->scheduler_active_affinity) ==
+		    cpulocal_get_index())) {
+		charge_quota(thread, curticks);
+		if (curticks >= thread->scheduler_quota_release) {
+			replenish_quota(thread, curticks);
+		}
+
+		if (thread->scheduler_quota_remaining == 0U) {
+			TRACE(INFO, INFO, "scheduler: throttle {:#x}",
+			      (uintptr_t)thread);
+			atomic_store_relaxed(
+				&thread->scheduler_quota_throttled,
+				atomic_load_relaxed(
+					&thread->scheduler_quota_throttled) +
+					1U);
+			scheduler_block(thread,
+					SCHEDULER_BLOCK_QUOTA_THROTTLED);
+			timer_enqueue(timer, thread->scheduler_quota_release);
+			need_schedule = true;
+		} else {
+			timer_enqueue(timer, curticks +
+						     thread->scheduler_quota_remaining);
+		}
+	} else {
+		// The thread stopped running before the timer expired, and
+		// has been charged already. If it is running elsewhere, the
+		// timer has been requeued there.
+	}
+
+	scheduler_unlock_nopreempt(thread);
+
+	if (need_schedule) {
+		scheduler_trigger();
+	}
+
+	return true;
+}
+
 scheduler_block_properties_t
 scheduler_fprr_handle_scheduler_get_block_properties(scheduler_block_t block)
 {
@@ -417,6 +940,17 @@ scheduler_fprr_handle_scheduler_get_block_properties(scheduler_block_t block)
 	return props;
 }
 
+// Allow a thread to run on its new CPU after an affinity change.
+static bool
+finish_affinity_change(thread_t *thread) REQUIRE_SCHEDULER_LOCK(thread)
+{
+#if defined(SCHEDULER_FPRR_LATENCY_STATS)
+	stats_migration_done(thread);
+#endif
+
+	return scheduler_unblock(thread, SCHEDULER_BLOCK_AFFINITY_CHANGED);
+}
+
 rcu_update_status_t
 scheduler_fprr_handle_affinity_change_update(rcu_entry_t *entry)
 {
@@ -435,7 +969,7 @@ scheduler_fprr_handle_affinity_change_update(rcu_entry_t *entry)
 						      next_cpu);
 
 	scheduler_lock_nopreempt(thread);
-	if (scheduler_unblock(thread, SCHEDULER_BLOCK_AFFINITY_CHANGED)) {
+	if (finish_affinity_change(thread)) {
 		rcu_update_status_set_need_schedule(&ret, true);
 	}
 	scheduler_unlock_nopreempt(thread);
@@ -451,32 +985,293 @@ set_next_timeout(scheduler_t *scheduler, thread_t *target)
 {
 	assert_spinlock_held(&scheduler->lock);
 
-	bool need_timeout = false;
+	bool	need_timeout = false;
+	ticks_t timeout	     = 0U;
 
 	if (target != idle_thread()) {
-		// A timeout needs to be set if the scheduler queue
-		// for the current priority is not empty, or if we
-		// may yield to another target.
-		index_t i = SCHEDULER_MAX_PRIORITY - target->scheduler_priority;
-		need_timeout = bitmap_isset(scheduler->prio_bitmap, i) ||
-			       atomic_load_relaxed(&target->scheduler_yielding);
+		if (has_deadline_budget(target)) {
+			// Deadline threads run until their budget is exhausted
+			// or a thread with an earlier deadline is woken, unless
+			// they are yielding.
+			need_timeout = atomic_load_relaxed(
+				&target->scheduler_yielding);
+		} else {
+			// A timeout needs to be set if the scheduler queue
+			// for the current priority is not empty, if we may
+			// yield to another target, or if the target is
+			// boosted and the boost must end with its timeslice.
+			// Otherwise the target runs without a timer until
+			// another thread of the same priority is queued,
+			// which will set it then.
+			index_t i = SCHEDULER_MAX_PRIORITY -
+				    get_priority(target);
+			need_timeout =
+				bitmap_isset(scheduler->prio_bitmap, i) ||
+				atomic_load_relaxed(
+					&target->scheduler_yielding) ||
+				(target->scheduler_boost != 0U);
+		}
+
+		if (need_timeout) {
+			timeout = get_target_timeout(scheduler, target);
+		}
+
+		ticks_t deadline_timeout;
+		if (has_deadline_budget(target)) {
+			// Enforce the target's budget.
+			deadline_timeout = scheduler->schedtime +
+					   target->scheduler_deadline_remaining;
+		} else if (is_deadline_thread(target)) {
+			// Replenish the target's budget.
+			deadline_timeout = target->scheduler_deadline_release;
+		} else {
+			deadline_timeout = timeout;
+		}
+
+		if (!need_timeout || (deadline_timeout < timeout)) {
+			timeout = deadline_timeout;
+		}
+		need_timeout = need_timeout || is_deadline_thread(target);
+	}
+
+	// Replenish any queued threads that have exhausted their budget.
+	thread_t *thread;
+	list_foreach_container (thread, &scheduler->deadline_throttled, thread,
+				scheduler_deadline_node) {
+		ticks_t release = thread->scheduler_deadline_release;
+		if (!need_timeout || (release < timeout)) {
+			timeout	     = release;
+			need_timeout = true;
+		}
 	}
 
 	if (need_timeout) {
-		ticks_t timeout = get_target_timeout(scheduler, target);
 		timer_update(&scheduler->timer, timeout);
 	} else {
 		timer_dequeue(&scheduler->timer);
 	}
 }
 
-static thread_t *
-get_next_target(scheduler_t *scheduler, ticks_t curticks)
-	REQUIRE_SPINLOCK(scheduler->lock)
+#if defined(SCHEDULER_FPRR_LOAD_BALANCE) && defined(INTERFACE_VCPU)
+static void
+set_cpu_idle(cpu_index_t cpu, bool idle)
 {
-	assert(scheduler != NULL);
-	assert_spinlock_held(&scheduler->lock);
-
+	// Avoid writing to the shared bitmap unless the state has changed.
+	if (bitmap_atomic_isset(scheduler_idle_cpus, cpu,
+				memory_order_relaxed) != idle) {
+		if (idle) {
+			bitmap_atomic_set(scheduler_idle_cpus, cpu,
+					  memory_order_relaxed);
+		} else {
+			bitmap_atomic_clear(scheduler_idle_cpus, cpu,
+					    memory_order_relaxed);
+		}
+	}
+}
+
+static bool
+can_balance_thread(const thread_t *thread)
+{
+	// Only VCPU threads are balanced. Hypervisor threads with a valid
+	// affinity have been deliberately placed by their creators.
+	//
+	// Note that the pin count may be read here without holding the
+	// thread's scheduler lock; in that case the result is only a hint, and
+	// scheduler_set_affinity() will check it again.
+	//
+	// Deadline threads are not balanced, as their bandwidth is reserved
+	// on their affinity CPU.
+	//
+	// Threads whose affinity change requests a grace period are not
+	// balanced either, as they would stay blocked until it ends, while
+	// this CPU has nothing to run.
+	return (thread->kind == THREAD_KIND_VCPU) &&
+	       !is_deadline_thread(thread) &&
+	       (atomic_load_relaxed(&thread->scheduler_pin_count) == 0U) &&
+	       !trigger_scheduler_affinity_change_needs_sync_event(thread);
+}
+
+static void
+kick_idle_cpu(cpu_index_t busy_cpu) REQUIRE_PREEMPT_DISABLED
+{
+	cpu_index_t this_cpu = cpulocal_get_index();
+	cpu_index_t target   = CPU_INDEX_INVALID;
+
+	// Prefer an idle CPU in the busy CPU's cluster, so the migrated thread
+	// keeps any cache state it has in the shared cluster cache.
+	BITMAP_ATOMIC_FOREACH_SET_BEGIN(i, scheduler_idle_cpus,
+					PLATFORM_MAX_CORES)
+		cpu_index_t cpu = (cpu_index_t)i;
+		if ((cpu == busy_cpu) || (cpu == this_cpu) ||
+		    scheduler_is_cpu_isolated(cpu)) {
+			continue;
+		}
+		if (!cpulocal_index_valid(target)) {
+			target = cpu;
+		}
+		if (cpus_share_cluster(cpu, busy_cpu)) {
+			target = cpu;
+			break;
+		}
+	BITMAP_ATOMIC_FOREACH_SET_END
+
+	if (cpulocal_index_valid(target)) {
+		// Wake a single idle CPU; it will look for the busiest
+		// runqueue in its idle_yield handler.
+		ipi_one_idle(IPI_REASON_RESCHEDULE, target);
+	}
+}
+
+static cpu_index_t
+find_busiest_cpu(cpu_index_t this_cpu)
+{
+	cpu_index_t busiest	   = CPU_INDEX_INVALID;
+	count_t	    busiest_queued = 0U;
+	bool	    busiest_local  = false;
+
+	for (cpu_index_t cpu = 0U; cpulocal_index_valid(cpu); cpu++) {
+		if (cpu == this_cpu) {
+			continue;
+		}
+
+		scheduler_t *scheduler = &CPULOCAL_BY_INDEX(scheduler, cpu);
+		count_t queued = atomic_load_relaxed(&scheduler->queued_count);
+		if (queued == 0U) {
+			continue;
+		}
+
+		// Pulling work within the cluster is cheaper than pulling it
+		// across clusters, so any busy CPU in this cluster is
+		// preferred over a busier CPU in another cluster.
+		bool local = cpus_share_cluster(cpu, this_cpu);
+		if ((local && !busiest_local) ||
+		    ((local == busiest_local) && (queued > busiest_queued))) {
+			busiest	       = cpu;
+			busiest_queued = queued;
+			busiest_local  = local;
+		}
+	}
+
+	return busiest;
+}
+
+static thread_t *
+select_balance_target(scheduler_t *scheduler, cpu_index_t this_cpu)
+	REQUIRE_SPINLOCK(scheduler->lock)
+{
+	assert_spinlock_held(&scheduler->lock);
+
+	thread_t *target = NULL;
+
+	// If the scheduler has no active thread, the head of its runqueue is
+	// about to run there; leave it alone.
+	if (scheduler->active_thread == NULL) {
+		goto out;
+	}
+
+	// Take the highest-priority waiting thread that is allowed to move,
+	// preferring one that last ran on this CPU and may still have warm
+	// cache state here.
+	BITMAP_FOREACH_SET_BEGIN(i, scheduler->prio_bitmap,
+				 SCHEDULER_NUM_PRIORITIES)
+		thread_t *thread;
+		list_t	 *list = &scheduler->runqueue[i];
+
+		list_foreach_container (thread, list, thread,
+					scheduler_list_node) {
+			if (!can_balance_thread(thread)) {
+				continue;
+			}
+			if (target == NULL) {
+				target = thread;
+			}
+			if (thread->scheduler_prev_affinity == this_cpu) {
+				target = thread;
+				break;
+			}
+		}
+
+		if (target != NULL) {
+			break;
+		}
+	BITMAP_FOREACH_SET_END
+
+out:
+	return target;
+}
+
+idle_state_t
+scheduler_fprr_handle_idle_yield(bool in_idle_thread)
+{
+	idle_state_t ret = IDLE_STATE_IDLE;
+
+	if (!in_idle_thread) {
+		goto out;
+	}
+
+	// Isolated CPUs only run the threads explicitly assigned to them.
+	cpu_index_t this_cpu = cpulocal_get_index();
+	if (scheduler_is_cpu_isolated(this_cpu)) {
+		goto out;
+	}
+
+	cpu_index_t busy_cpu = find_busiest_cpu(this_cpu);
+	if (!cpulocal_index_valid(busy_cpu)) {
+		goto out;
+	}
+
+	scheduler_t *busy   = &CPULOCAL_BY_INDEX(scheduler, busy_cpu);
+	thread_t    *thread = NULL;
+
+	// The thread's scheduler lock must be acquired before the scheduler
+	// lock, so we can't hold the busy CPU's lock while migrating the
+	// thread. Take a reference to it instead, then check that it is still
+	// waiting on the busy CPU once the thread's lock is held.
+	rcu_read_start();
+	spinlock_acquire_nopreempt(&busy->lock);
+	thread = select_balance_target(busy, this_cpu);
+	if ((thread != NULL) && !object_get_thread_safe(thread)) {
+		thread = NULL;
+	}
+	spinlock_release_nopreempt(&busy->lock);
+	rcu_read_finish();
+
+	if (thread == NULL) {
+		goto out;
+	}
+
+	scheduler_lock_nopreempt(thread);
+	if (sched_state_get_queued(&thread->scheduler_state) &&
+	    !sched_state_get_running(&thread->scheduler_state) &&
+	    (thread->scheduler_affinity == busy_cpu)) {
+		// This uses the normal affinity change path, so it respects
+		// the pin count and any scheduler_set_affinity_prepare
+		// handlers, and defers the move for an RCU grace period if
+		// any affinity_changed handler requests it.
+		error_t err = scheduler_set_affinity(thread, this_cpu);
+		if (err == OK) {
+			TRACE(INFO, INFO,
+			      "scheduler: balance {:#x} from CPU {:d} to {:d}",
+			      (uintptr_t)thread, (register_t)busy_cpu,
+			      (register_t)this_cpu);
+			ret = IDLE_STATE_RESCHEDULE;
+		}
+	}
+	scheduler_unlock_nopreempt(thread);
+
+	object_put_thread(thread);
+out:
+	return ret;
+}
+#endif
+
+static thread_t *
+get_next_target(scheduler_t *scheduler, ticks_t curticks)
+	REQUIRE_SPINLOCK(scheduler->lock)
+{
+	assert(scheduler != NULL);
+	assert_spinlock_held(&scheduler->lock);
+
 	thread_t *prev		    = scheduler->active_thread;
 	thread_t *target	    = prev;
 	bool	  timeslice_expired = false;
@@ -485,38 +1280,102 @@ get_next_target(scheduler_t *scheduler, ticks_t curticks)
 	if (target != NULL) {
 		timeslice_expired =
 			update_timeslice(scheduler, target, curticks);
+		update_deadline_budget(scheduler, target, curticks);
+		(void)replenish_deadline(target, curticks);
 	}
 
-	if (bitmap_ffs(scheduler->prio_bitmap, SCHEDULER_NUM_PRIORITIES, &i)) {
+	replenish_throttled(scheduler, curticks);
+
+	thread_t *deadline_head = get_deadline_head(scheduler);
+	thread_t *gang_head	= get_gang_head(scheduler, target);
+
+	if ((target != NULL) && has_deadline_budget(target)) {
+		// Deadline threads can only be preempted by deadline threads
+		// with earlier deadlines.
+		if ((deadline_head != NULL) &&
+		    (deadline_head->scheduler_deadline_absolute <
+		     target->scheduler_deadline_absolute)) {
+			remove_from_runqueue(scheduler, deadline_head);
+			target = deadline_head;
+		}
+	} else if (deadline_head != NULL) {
+		// Deadline threads always run ahead of priority threads.
+		remove_from_runqueue(scheduler, deadline_head);
+		target = deadline_head;
+	} else if (gang_head != NULL) {
+		// Co-schedule a thread whose gang is running on other CPUs.
+		remove_from_runqueue(scheduler, gang_head);
+		target = gang_head;
+	} else if (bitmap_ffs(scheduler->prio_bitmap, SCHEDULER_NUM_PRIORITIES,
+			      &i)) {
 		priority_t prio = SCHEDULER_MAX_PRIORITY - i;
 		// Always prefer targets with higher priority, and if timeslice
 		// has been used up, targets with the same priority.
 		bool should_switch =
 			(target == NULL) ||
-			(timeslice_expired
-				 ? (prio >= target->scheduler_priority)
-				 : (prio > target->scheduler_priority));
+			(timeslice_expired ? (prio >= get_priority(target))
+					   : (prio > get_priority(target)));
 		if (should_switch) {
 			target = pop_runqueue_head(scheduler, i);
 		}
 	}
 
-	if (target != NULL) {
-		scheduler->active_thread = target;
-	} else {
-		target			 = idle_thread();
-		scheduler->active_thread = NULL;
+	set_active_thread(scheduler, target);
+	if (target == NULL) {
+		target = idle_thread();
 	}
 
 	scheduler->schedtime = curticks;
 
 	if ((prev != NULL) && (target != prev)) {
 		add_to_runqueue(scheduler, prev, timeslice_expired);
+#if defined(SCHEDULER_FPRR_LATENCY_STATS)
+		stats_count(&prev->scheduler_stats.preemptions);
+		stats_count(&scheduler->stats.preemptions);
+#endif
 	}
 
+#if defined(SCHEDULER_FPRR_LATENCY_STATS)
+	if ((scheduler->active_thread != NULL) && (target != prev)) {
+		stats_thread_selected(scheduler, target, curticks);
+	}
+#endif
+
 	return target;
 }
 
+static void
+update_wakeup_priority(scheduler_t *scheduler, bool can_idle)
+	REQUIRE_SPINLOCK(scheduler->lock)
+{
+	assert_spinlock_held(&scheduler->lock);
+
+	// Remote CPUs only need to interrupt us for a wakeup if the woken
+	// thread might preempt the active thread, or if the active thread may
+	// idle without running the scheduler again.
+	thread_t  *active = scheduler->active_thread;
+	priority_t prio	  = ((active == NULL) || can_idle)
+				    ? SCHEDULER_MIN_PRIORITY
+				    : get_priority(active);
+
+	priority_t old = atomic_load_relaxed(&scheduler->wakeup_priority);
+	if (prio > old) {
+		atomic_store_relaxed(&scheduler->wakeup_priority, prio);
+	} else if (prio < old) {
+		// A remote CPU may have skipped the IPI for a thread it pushed
+		// while the old priority was in effect. Recheck the list after
+		// lowering the priority; this pairs with the push.
+		atomic_store_explicit(&scheduler->wakeup_priority, prio,
+				      memory_order_seq_cst);
+		if (atomic_load_explicit(&scheduler->wakeup_list,
+					 memory_order_seq_cst) != NULL) {
+			scheduler_trigger();
+		}
+	} else {
+		// Unchanged.
+	}
+}
+
 static bool
 can_yield_to(thread_t *yield_to) REQUIRE_SCHEDULER_LOCK(yield_to)
 {
@@ -591,6 +1450,10 @@ scheduler_schedule(void)
 		thread_t    *current   = thread_get_self();
 		thread_t    *target;
 
+		// Queue any threads woken by remote CPUs, in case the IPI
+		// they sent has been cleared without being handled.
+		(void)drain_remote_wakeups();
+
 		rcu_read_start();
 
 		trigger_scheduler_schedule_event(current,
@@ -600,11 +1463,15 @@ scheduler_schedule(void)
 
 		spinlock_acquire_nopreempt(&scheduler->lock);
 		target	      = get_next_target(scheduler, curticks);
-		bool can_idle = bitmap_empty(scheduler->prio_bitmap,
-					     SCHEDULER_NUM_PRIORITIES);
+		bool can_idle = runqueue_is_empty(scheduler);
 		set_next_timeout(scheduler, target);
+		update_wakeup_priority(scheduler, can_idle);
 		spinlock_release_nopreempt(&scheduler->lock);
 
+#if defined(SCHEDULER_FPRR_LOAD_BALANCE) && defined(INTERFACE_VCPU)
+		set_cpu_idle(cpulocal_get_index(), target == idle_thread());
+#endif
+
 		target = select_yield_target(target, &can_idle);
 
 		trigger_scheduler_selected_thread_event(target, &can_idle);
@@ -743,6 +1610,183 @@ scheduler_unlock_nopreempt(thread_t *thread)
 	spinlock_release_nopreempt(&thread->scheduler_lock);
 }
 
+static bool
+enqueue_thread(scheduler_t *scheduler, cpu_index_t affinity, thread_t *thread)
+	REQUIRE_SCHEDULER_LOCK(thread)
+{
+	assert_spinlock_held(&thread->scheduler_lock);
+
+	bool	  need_schedule;
+	thread_t *active;
+#if defined(SCHEDULER_FPRR_LOAD_BALANCE) && defined(INTERFACE_VCPU)
+	bool need_balance;
+#endif
+
+	(void)replenish_deadline(thread, timer_get_current_timer_ticks());
+
+	spinlock_acquire_nopreempt(&scheduler->lock);
+
+	active = scheduler->active_thread;
+	if (active == NULL) {
+		// The newly unblocked thread is the only one runnable,
+		// so a reschedule will always be needed.
+		need_schedule = true;
+	} else if (runqueue_is_empty(scheduler)) {
+		// The scheduler's current thread was scheduled with
+		// can_idle set, so it may have gone idle without
+		// rescheduling. Force a reschedule regardless of
+		// priority, to ensure that it doesn't needlessly block
+		// a lower-priority threads.
+		need_schedule = true;
+	} else if (has_deadline_budget(thread)) {
+		// A deadline thread preempts any priority thread, or a
+		// deadline thread with a later deadline.
+		need_schedule = !has_deadline_budget(active) ||
+				(thread->scheduler_deadline_absolute <
+				 active->scheduler_deadline_absolute);
+	} else if (has_deadline_budget(active)) {
+		need_schedule = false;
+	} else if (get_priority(thread) == get_priority(active)) {
+		// The active thread only needs to be preempted when its
+		// timeslice expires, but the timeslice timer is not armed
+		// while there are no other threads at its priority. It can be
+		// armed directly on this CPU; a remote CPU must reschedule.
+		need_schedule = affinity != cpulocal_get_index();
+	} else {
+		// There is already an active thread; a reschedule is
+		// needed if the newly unblocked thread has higher priority.
+		need_schedule = get_priority(thread) > get_priority(active);
+	}
+
+	// Each thread has a reference to itself which remains until it
+	// exits. Since threads are not runnable after exiting, the
+	// scheduler queues can safely use this reference instead of
+	// getting an additional one.
+	add_to_runqueue(scheduler, thread, true);
+
+	if (!need_schedule && (affinity == cpulocal_get_index())) {
+		assert(active != NULL);
+		set_next_timeout(scheduler, active);
+	}
+
+#if defined(SCHEDULER_FPRR_LOAD_BALANCE) && defined(INTERFACE_VCPU)
+	// If there is already an active thread, one of the two will
+	// have to wait; let an idle CPU try to take it.
+	need_balance = (scheduler->active_thread != NULL) &&
+		       can_balance_thread(thread);
+#endif
+
+	spinlock_release_nopreempt(&scheduler->lock);
+
+#if defined(SCHEDULER_FPRR_LOAD_BALANCE) && defined(INTERFACE_VCPU)
+	if (need_balance) {
+		kick_idle_cpu(affinity);
+	}
+#else
+	(void)affinity;
+#endif
+
+	return need_schedule;
+}
+
+static void
+push_remote_wakeup(scheduler_t *scheduler, cpu_index_t affinity,
+		   thread_t *thread) REQUIRE_SCHEDULER_LOCK(thread)
+{
+	assert_spinlock_held(&thread->scheduler_lock);
+	assert(!sched_state_get_wakeup_pending(&thread->scheduler_state));
+
+	sched_state_set_wakeup_pending(&thread->scheduler_state, true);
+	sched_state_set_remote_wakeup(&thread->scheduler_state, true);
+
+	// The list holds a reference to the thread, because it may be removed
+	// from the scheduler, migrated and even freed elsewhere before the
+	// target CPU gets around to draining the list.
+	(void)object_get_thread_additional(thread);
+
+	thread_t *head = atomic_load_relaxed(&scheduler->wakeup_list);
+	do {
+		thread->scheduler_wakeup_next = head;
+	} while (!atomic_compare_exchange_weak_explicit(
+		&scheduler->wakeup_list, &head, thread, memory_order_seq_cst,
+		memory_order_relaxed));
+
+	// Send at most one IPI per drain of the list, and only for threads
+	// that may need to preempt the target CPU's active thread. Anything
+	// else will be picked up the next time the target CPU schedules.
+	if ((is_deadline_thread(thread) ||
+	     (get_priority(thread) >=
+	      atomic_load_explicit(&scheduler->wakeup_priority,
+				   memory_order_seq_cst))) &&
+	    !atomic_load_explicit(&scheduler->wakeup_kicked,
+				  memory_order_seq_cst) &&
+	    !atomic_exchange_explicit(&scheduler->wakeup_kicked, true,
+				      memory_order_seq_cst)) {
+		ipi_one(IPI_REASON_RESCHEDULE, affinity);
+	}
+}
+
+static bool
+drain_remote_wakeups(void) REQUIRE_PREEMPT_DISABLED
+{
+	cpu_index_t  cpu	   = cpulocal_get_index();
+	scheduler_t *scheduler	   = &CPULOCAL_BY_INDEX(scheduler, cpu);
+	bool	     need_schedule = false;
+
+	// Clear the kicked flag before checking the list, so any thread pushed
+	// after this will send a new IPI if necessary. This must be done even
+	// if the list is empty: a pusher may set the flag after an earlier
+	// drain has already taken its thread, and if the flag stayed set, no
+	// later push would send an IPI. The seq_cst accesses pair with the
+	// push, so either the pusher sees the flag clear or we see its thread.
+	if (compiler_unexpected(
+		    atomic_load_relaxed(&scheduler->wakeup_kicked))) {
+		atomic_store_explicit(&scheduler->wakeup_kicked, false,
+				      memory_order_seq_cst);
+	}
+
+	if (compiler_expected(atomic_load_explicit(&scheduler->wakeup_list,
+						   memory_order_seq_cst) ==
+			      NULL)) {
+		goto out;
+	}
+
+	thread_t *thread = atomic_exchange_explicit(&scheduler->wakeup_list,
+						    NULL, memory_order_acq_rel);
+
+	while (thread != NULL) {
+		// The next pointer can't change until wakeup_pending is
+		// cleared, which only we can do.
+		thread_t *next = thread->scheduler_wakeup_next;
+
+		scheduler_lock_nopreempt(thread);
+		assert(sched_state_get_wakeup_pending(&thread->scheduler_state));
+		sched_state_set_wakeup_pending(&thread->scheduler_state, false);
+		thread->scheduler_wakeup_next = NULL;
+
+		// If the thread has been removed from the scheduler since it
+		// was pushed, there is nothing more to do; it may have already
+		// been queued elsewhere.
+		if (sched_state_get_remote_wakeup(&thread->scheduler_state)) {
+			assert(sched_state_get_queued(&thread->scheduler_state));
+			assert(thread->scheduler_affinity == cpu);
+
+			sched_state_set_remote_wakeup(&thread->scheduler_state,
+						      false);
+			if (enqueue_thread(scheduler, cpu, thread)) {
+				need_schedule = true;
+			}
+		}
+		scheduler_unlock_nopreempt(thread);
+
+		object_put_thread(thread);
+		thread = next;
+	}
+
+out:
+	return need_schedule;
+}
+
 static bool
 add_thread_to_scheduler(thread_t *thread) REQUIRE_SCHEDULER_LOCK(thread)
 {
@@ -752,54 +1796,33 @@ add_thread_to_scheduler(thread_t *thread) REQUIRE_SCHEDULER_LOCK(thread)
 	assert(!sched_state_get_exited(&thread->scheduler_state));
 	assert(can_be_scheduled(thread));
 
-	bool	    need_schedule;
-	cpu_index_t affinity = thread->scheduler_affinity;
+	bool	    need_schedule = false;
+	cpu_index_t affinity	  = thread->scheduler_affinity;
 
 	if (cpulocal_index_valid(affinity)) {
 		cpu_index_t  cpu = cpulocal_get_index();
 		scheduler_t *scheduler =
 			&CPULOCAL_BY_INDEX(scheduler, affinity);
 
-		spinlock_acquire_nopreempt(&scheduler->lock);
-
-		if (scheduler->active_thread == NULL) {
-			// The newly unblocked thread is the only one runnable,
-			// so a reschedule will always be needed.
-			need_schedule = true;
-		} else if (bitmap_empty(scheduler->prio_bitmap,
-					SCHEDULER_NUM_PRIORITIES)) {
-			// The scheduler's current thread was scheduled with
-			// can_idle set, so it may have gone idle without
-			// rescheduling. Force a reschedule regardless of
-			// priority, to ensure that it doesn't needlessly block
-			// a lower-priority threads.
-			need_schedule = true;
-		} else {
-			// There is already an active thread; a reschedule is
-			// needed if the newly unblocked thread has equal or
-			// higher priority
-			need_schedule =
-				thread->scheduler_priority >=
-				scheduler->active_thread->scheduler_priority;
-		}
-
 		reset_sched_params(thread);
 		sched_state_set_queued(&thread->scheduler_state, true);
 
-		// Each thread has a reference to itself which remains until it
-		// exits. Since threads are not runnable after exiting, the
-		// scheduler queues can safely use this reference instead of
-		// getting an additional one.
-		add_to_runqueue(scheduler, thread, true);
-
-		spinlock_release_nopreempt(&scheduler->lock);
-
-		if (need_schedule && (cpu != affinity)) {
-			ipi_one(IPI_REASON_RESCHEDULE, affinity);
-			need_schedule = false;
+		if (cpu == affinity) {
+			need_schedule = enqueue_thread(scheduler, affinity,
+						       thread);
+		} else if (compiler_expected(!sched_state_get_wakeup_pending(
+				   &thread->scheduler_state))) {
+			// Hand the thread to the remote CPU without touching
+			// its scheduler lock.
+			push_remote_wakeup(scheduler, affinity, thread);
+		} else {
+			// The thread is still linked into a wakeup list by an
+			// earlier unblock, so it can't be pushed again. Fall
+			// back to queueing it directly.
+			if (enqueue_thread(scheduler, affinity, thread)) {
+				ipi_one(IPI_REASON_RESCHEDULE, affinity);
+			}
 		}
-	} else {
-		need_schedule = false;
 	}
 
 	return need_schedule;
@@ -821,16 +1844,36 @@ remove_thread_from_scheduler(thread_t *thread) REQUIRE_SCHEDULER_LOCK(thread)
 			&CPULOCAL_BY_INDEX(scheduler, affinity);
 		bool was_active = false;
 
-		spinlock_acquire_nopreempt(&scheduler->lock);
-		if (scheduler->active_thread == thread) {
-			scheduler->active_thread = NULL;
-			was_active		 = true;
+		if (sched_state_get_remote_wakeup(&thread->scheduler_state)) {
+			// The thread has not been moved from the wakeup list
+			// to the runqueue yet. Leave it in the list; it will
+			// be discarded when the list is drained.
+			sched_state_set_remote_wakeup(&thread->scheduler_state,
+						      false);
 		} else {
-			remove_from_runqueue(scheduler, thread);
+			spinlock_acquire_nopreempt(&scheduler->lock);
+			if (scheduler->active_thread == thread) {
+				update_deadline_budget(
+					scheduler, thread,
+					timer_get_current_timer_ticks());
+				set_active_thread(scheduler, NULL);
+				was_active = true;
+			} else {
+				remove_from_runqueue(scheduler, thread);
+				// The active thread may have no competitors
+				// left; if so, cancel its timeslice timer.
+				if ((scheduler->active_thread != NULL) &&
+				    (affinity == cpulocal_get_index())) {
+					set_next_timeout(
+						scheduler,
+						scheduler->active_thread);
+				}
+			}
+			spinlock_release_nopreempt(&scheduler->lock);
 		}
-		spinlock_release_nopreempt(&scheduler->lock);
 
 		sched_state_set_queued(&thread->scheduler_state, false);
+		thread->scheduler_boost = 0U;
 
 		if (compiler_unexpected(was_active && was_yielding)) {
 			// The thread was actively yielding; trigger a
@@ -884,11 +1927,13 @@ start_affinity_changed_events(thread_t *thread) REQUIRE_SCHEDULER_LOCK(thread)
 		thread->scheduler_affinity, &need_sync);
 
 	if (need_sync) {
+		// The thread stays blocked until the sync event has been
+		// handled, because handlers may rely on it before the thread
+		// runs on its new CPU.
 		rcu_enqueue(&thread->scheduler_rcu_entry,
 			    RCU_UPDATE_CLASS_AFFINITY_CHANGED);
 	} else {
-		need_schedule = scheduler_unblock(
-			thread, SCHEDULER_BLOCK_AFFINITY_CHANGED);
+		need_schedule = finish_affinity_change(thread);
 		object_put_thread(thread);
 	}
 
@@ -924,6 +1969,23 @@ scheduler_fprr_handle_thread_context_switch_pre(thread_t *next)
 		sched_state_set_running(&next->scheduler_state, true);
 		CPULOCAL(running_thread) = next;
 		atomic_store_relaxed(&next->scheduler_active_affinity, cpu);
+
+		if (has_quota(next)) {
+			ticks_t curticks = timer_get_current_timer_ticks();
+			if (curticks >= next->scheduler_quota_release) {
+				replenish_quota(next, curticks);
+			}
+			next->scheduler_quota_start = curticks;
+
+			// A killed thread may run while throttled; its timer
+			// is already queued to replenish the budget.
+			if (!scheduler_is_blocked(
+				    next, SCHEDULER_BLOCK_QUOTA_THROTTLED)) {
+				timer_update(&next->scheduler_quota_timer,
+					     curticks +
+						     next->scheduler_quota_remaining);
+			}
+		}
 	} else {
 		err = ERROR_DENIED;
 		if (yielded_from != NULL) {
@@ -951,6 +2013,14 @@ scheduler_fprr_handle_thread_context_switch_post(thread_t *prev)
 	scheduler_lock_nopreempt(prev);
 	sched_state_set_running(&prev->scheduler_state, false);
 
+	if (has_quota(prev)) {
+		charge_quota(prev, timer_get_current_timer_ticks());
+		if (!scheduler_is_blocked(prev,
+					  SCHEDULER_BLOCK_QUOTA_THROTTLED)) {
+			timer_dequeue(&prev->scheduler_quota_timer);
+		}
+	}
+
 	if (sched_state_get_need_requeue(&prev->scheduler_state)) {
 		// The thread may have blocked after being marked for a
 		// requeue. Ensure it is still runnable prior to adding
@@ -994,6 +2064,12 @@ scheduler_block(thread_t *thread, scheduler_block_t block)
 	bitmap_set(thread->scheduler_block_bits, (index_t)block);
 	if (sched_state_get_queued(&thread->scheduler_state) &&
 	    !can_be_scheduled(thread)) {
+		if ((thread->scheduler_boost != 0U) &&
+		    (block != SCHEDULER_BLOCK_QUOTA_THROTTLED)) {
+			// The thread blocked while still boosted, so it is
+			// not CPU-bound; restore its full boost.
+			thread->scheduler_boost_shift = 0U;
+		}
 		remove_thread_from_scheduler(thread);
 	}
 }
@@ -1021,6 +2097,11 @@ scheduler_unblock(thread_t *thread, scheduler_block_t block)
 
 	if (need_schedule) {
 		assert(!sched_state_get_queued(&thread->scheduler_state));
+#if defined(SCHEDULER_FPRR_LATENCY_STATS)
+		thread->scheduler_stats_wakeup_time =
+			timer_get_current_timer_ticks();
+		thread->scheduler_stats_woken = true;
+#endif
 		// The thread may have not finished running after the block.
 		// If so, mark for requeue. Otherwise it is safe to directly
 		// queue the thread.
@@ -1090,15 +2171,21 @@ void
 scheduler_pin(thread_t *thread)
 {
 	assert_spinlock_held(&thread->scheduler_lock);
-	thread->scheduler_pin_count++;
+
+	// The pin count is only modified with the scheduler lock held, but may
+	// be read without it as a hint by the load balancer.
+	count_t pin_count = atomic_load_relaxed(&thread->scheduler_pin_count);
+	atomic_store_relaxed(&thread->scheduler_pin_count, pin_count + 1U);
 }
 
 void
 scheduler_unpin(thread_t *thread)
 {
 	assert_spinlock_held(&thread->scheduler_lock);
-	assert(thread->scheduler_pin_count > 0U);
-	thread->scheduler_pin_count--;
+
+	count_t pin_count = atomic_load_relaxed(&thread->scheduler_pin_count);
+	assert(pin_count > 0U);
+	atomic_store_relaxed(&thread->scheduler_pin_count, pin_count - 1U);
 }
 
 cpu_index_t
@@ -1132,7 +2219,7 @@ scheduler_set_affinity(thread_t *thread, cpu_index_t target_cpu)
 		goto out;
 	}
 
-	if (thread->scheduler_pin_count != 0U) {
+	if (atomic_load_relaxed(&thread->scheduler_pin_count) != 0U) {
 		err = ERROR_DENIED;
 		goto out;
 	}
@@ -1142,17 +2229,37 @@ scheduler_set_affinity(thread_t *thread, cpu_index_t target_cpu)
 		goto out;
 	}
 
+	// Deadline threads need their bandwidth to be reserved on the new CPU.
+	bool reserve = is_deadline_thread(thread) &&
+		       cpulocal_index_valid(target_cpu) &&
+		       !sched_state_get_exited(&thread->scheduler_state);
+	if (reserve &&
+	    !deadline_admit(target_cpu, 0U, thread->scheduler_deadline_bw)) {
+		err = ERROR_NORESOURCES;
+		goto out;
+	}
+
 	err = trigger_scheduler_set_affinity_prepare_event(thread, prev_cpu,
 							   target_cpu);
 	if (err != OK) {
+		if (reserve) {
+			deadline_release(target_cpu,
+					 thread->scheduler_deadline_bw);
+		}
 		goto out;
 	}
 
+	release_deadline_reservation(thread);
+	sched_state_set_deadline_reserved(&thread->scheduler_state, reserve);
+
 	// Block the thread so affinity changes are serialised. We need to get
 	// an additional reference to the thread, otherwise it may be deleted
 	// prior to the completion of the affinity change.
 	(void)object_get_thread_additional(thread);
 	scheduler_block(thread, SCHEDULER_BLOCK_AFFINITY_CHANGED);
+#if defined(SCHEDULER_FPRR_LATENCY_STATS)
+	thread->scheduler_stats_migrate_time = timer_get_current_timer_ticks();
+#endif
 
 	thread->scheduler_prev_affinity = prev_cpu;
 	thread->scheduler_affinity	= target_cpu;
@@ -1173,9 +2280,161 @@ out:
 	return err;
 }
 
-static void
-update_sched_params(thread_t *thread, priority_t priority, ticks_t timeslice)
-	REQUIRE_SCHEDULER_LOCK(thread)
+static count_t
+get_cpu_load(cpu_index_t cpu)
+{
+	scheduler_t *scheduler = &CPULOCAL_BY_INDEX(scheduler, cpu);
+
+	// This is only a placement hint; it may be stale by the time the
+	// thread arrives, so read it without taking the CPU's lock.
+	count_t load = atomic_load_relaxed(&scheduler->queued_count);
+	if (atomic_load_relaxed(&scheduler->active)) {
+		load++;
+	}
+
+	return load;
+}
+
+error_t
+scheduler_set_affinity_cluster(thread_t *thread, cpu_index_t cluster_cpu)
+{
+	assert_spinlock_held(&thread->scheduler_lock);
+
+	error_t	    err;
+	cpu_index_t target = CPU_INDEX_INVALID;
+
+	if (!cpulocal_index_valid(cluster_cpu)) {
+		err = ERROR_ARGUMENT_INVALID;
+		goto out;
+	}
+
+	cpu_index_t cur_cpu  = thread->scheduler_affinity;
+	cpu_index_t prev_cpu = thread->scheduler_prev_affinity;
+
+	// Prefer the CPU the thread is already on, then the one it last ran
+	// on, as either may still hold its cache state.
+	if (cpulocal_index_valid(cur_cpu) &&
+	    cpus_share_cluster(cur_cpu, cluster_cpu)) {
+		target = cur_cpu;
+	} else if (cpulocal_index_valid(prev_cpu) &&
+		   platform_cpu_exists(prev_cpu) &&
+		   cpus_share_cluster(prev_cpu, cluster_cpu)) {
+		target = prev_cpu;
+	} else {
+		count_t target_load = 0U;
+
+		for (cpu_index_t cpu = 0U; cpulocal_index_valid(cpu); cpu++) {
+			if (!platform_cpu_exists(cpu) ||
+			    !cpus_share_cluster(cpu, cluster_cpu) ||
+			    scheduler_is_cpu_isolated(cpu)) {
+				continue;
+			}
+
+			count_t load = get_cpu_load(cpu);
+			if (!cpulocal_index_valid(target) ||
+			    (load < target_load)) {
+				target	    = cpu;
+				target_load = load;
+			}
+		}
+	}
+
+	if (!cpulocal_index_valid(target)) {
+		// Every CPU in the cluster is isolated; use the one requested.
+		target = cluster_cpu;
+	}
+
+	err = scheduler_set_affinity(thread, target);
+
+out:
+	return err;
+}
+
+bool
+scheduler_is_cpu_isolated(cpu_index_t cpu)
+{
+	assert(cpulocal_index_valid(cpu));
+
+	return bitmap_atomic_isset(scheduler_isolated_cpus, cpu,
+				   memory_order_relaxed);
+}
+
+cpu_index_t
+scheduler_get_housekeeping_cpu(cpu_index_t cpu)
+{
+	cpu_index_t target = CPU_INDEX_INVALID;
+
+	for (cpu_index_t i = 0U; cpulocal_index_valid(i); i++) {
+		if ((i == cpu) || !platform_cpu_exists(i) ||
+		    scheduler_is_cpu_isolated(i)) {
+			continue;
+		}
+		if (!cpulocal_index_valid(target)) {
+			target = i;
+		}
+		if (cpus_share_cluster(i, cpu)) {
+			target = i;
+			break;
+		}
+	}
+
+	return target;
+}
+
+error_t
+scheduler_set_cpu_isolated(cpu_index_t cpu, bool isolated)
+{
+	error_t err = OK;
+
+	if (!cpulocal_index_valid(cpu) || !platform_cpu_exists(cpu)) {
+		err = ERROR_ARGUMENT_INVALID;
+		goto out;
+	}
+
+	spinlock_acquire(&scheduler_isolation_lock);
+	if (!isolated) {
+		bitmap_atomic_clear(scheduler_isolated_cpus, cpu,
+				    memory_order_relaxed);
+	} else if (cpulocal_index_valid(scheduler_get_housekeeping_cpu(cpu))) {
+		bitmap_atomic_set(scheduler_isolated_cpus, cpu,
+				  memory_order_relaxed);
+	} else {
+		// At least one housekeeping CPU must remain to run the work
+		// offloaded from isolated CPUs.
+		err = ERROR_DENIED;
+	}
+	spinlock_release(&scheduler_isolation_lock);
+
+	if (err == OK) {
+		// The CPU applies the change itself, so modules can update
+		// their CPU-local state without locking.
+		ipi_one(IPI_REASON_SCHEDULER_ISOLATION, cpu);
+	}
+
+out:
+	return err;
+}
+
+bool
+scheduler_fprr_handle_ipi_isolation(void)
+{
+	cpu_index_t  cpu       = cpulocal_get_index();
+	scheduler_t *scheduler = &CPULOCAL_BY_INDEX(scheduler, cpu);
+	bool	     isolated  = scheduler_is_cpu_isolated(cpu);
+
+	if (scheduler->isolated != isolated) {
+		scheduler->isolated = isolated;
+		TRACE(INFO, INFO, "scheduler: CPU {:d} isolated {:d}",
+		      (register_t)cpu, (register_t)isolated);
+		trigger_scheduler_cpu_isolation_changed_event(isolated);
+	}
+
+	// Reschedule, in case the timeslice timer needs to be reconsidered.
+	return true;
+}
+
+static bool
+begin_sched_params_update(thread_t *thread) REQUIRE_SCHEDULER_LOCK(thread)
 {
 	assert_spinlock_held(&thread->scheduler_lock);
 
@@ -1190,8 +2449,14 @@ update_sched_params(thread_t *thread, priority_t priority, ticks_t timeslice)
 		remove_thread_from_scheduler(thread);
 	}
 
-	thread->scheduler_priority	 = priority;
-	thread->scheduler_base_timeslice = timeslice;
+	return requeue;
+}
+
+static void
+end_sched_params_update(thread_t *thread, bool requeue)
+	REQUIRE_SCHEDULER_LOCK(thread)
+{
+	assert_spinlock_held(&thread->scheduler_lock);
 
 	if (requeue) {
 		bool need_schedule;
@@ -1209,6 +2474,18 @@ update_sched_params(thread_t *thread, priority_t priority, ticks_t timeslice)
 	}
 }
 
+static void
+update_sched_params(thread_t *thread, priority_t priority, ticks_t timeslice)
+	REQUIRE_SCHEDULER_LOCK(thread)
+{
+	bool requeue = begin_sched_params_update(thread);
+
+	thread->scheduler_priority	 = priority;
+	thread->scheduler_base_timeslice = timeslice;
+
+	end_sched_params_update(thread, requeue);
+}
+
 error_t
 scheduler_set_priority(thread_t *thread, priority_t priority)
 {
@@ -1258,14 +2535,340 @@ out:
 	return err;
 }
 
+void
+scheduler_set_inherited_priority(thread_t *thread, priority_t priority)
+{
+	assert_spinlock_held(&thread->scheduler_lock);
+	assert(priority <= SCHEDULER_MAX_PRIORITY);
+
+	if (thread->scheduler_inherited_priority != priority) {
+		bool requeue = begin_sched_params_update(thread);
+		thread->scheduler_inherited_priority = priority;
+		end_sched_params_update(thread, requeue);
+	}
+}
+
+priority_t
+scheduler_get_effective_priority(thread_t *thread)
+{
+	assert_spinlock_held(&thread->scheduler_lock);
+
+	return get_priority(thread);
+}
+
+error_t
+scheduler_set_irq_boost(thread_t *thread, priority_t boost)
+{
+	error_t err = OK;
+
+	assert_spinlock_held(&thread->scheduler_lock);
+
+	if (boost > SCHEDULER_MAX_IRQ_BOOST) {
+		err = ERROR_ARGUMENT_INVALID;
+		goto out;
+	}
+
+	// Any boost already in effect is left to expire normally.
+	thread->scheduler_irq_boost   = boost;
+	thread->scheduler_boost_shift = 0U;
+
+out:
+	return err;
+}
+
+void
+scheduler_gang_start(thread_t *thread)
+{
+	bool	    need_ipi = false;
+	cpu_index_t affinity;
+
+	scheduler_lock(thread);
+	affinity = thread->scheduler_affinity;
+
+	// The thread must be in a remote CPU's runqueue; threads in a remote
+	// wakeup list will be queued soon anyway.
+	if (cpulocal_index_valid(affinity) &&
+	    (affinity != cpulocal_get_index()) &&
+	    sched_state_get_queued(&thread->scheduler_state) &&
+	    !sched_state_get_running(&thread->scheduler_state) &&
+	    !sched_state_get_remote_wakeup(&thread->scheduler_state)) {
+		scheduler_t *scheduler =
+			&CPULOCAL_BY_INDEX(scheduler, affinity);
+
+		spinlock_acquire_nopreempt(&scheduler->lock);
+		if ((scheduler->active_thread != thread) &&
+		    (scheduler->gang_thread != thread)) {
+			scheduler->gang_thread = thread;
+			need_ipi	       = true;
+		}
+		spinlock_release_nopreempt(&scheduler->lock);
+	}
+
+	scheduler_unlock(thread);
+
+	if (need_ipi) {
+		ipi_one(IPI_REASON_RESCHEDULE, affinity);
+	}
+}
+
+void
+scheduler_gang_stop(thread_t *thread)
+{
+	bool	    need_ipi = false;
+	cpu_index_t affinity;
+
+	scheduler_lock(thread);
+	affinity = thread->scheduler_affinity;
+
+	if (cpulocal_index_valid(affinity) &&
+	    (affinity != cpulocal_get_index()) &&
+	    sched_state_get_running(&thread->scheduler_state)) {
+		scheduler_t *scheduler =
+			&CPULOCAL_BY_INDEX(scheduler, affinity);
+
+		spinlock_acquire_nopreempt(&scheduler->lock);
+		// Deadline threads keep running until their budget is used.
+		if ((scheduler->active_thread == thread) &&
+		    !has_deadline_budget(thread)) {
+			// Expire the timeslice, so the next schedule switches
+			// to any other thread of the same priority.
+			thread->scheduler_active_timeslice = 0U;
+			need_ipi			   = true;
+		}
+		spinlock_release_nopreempt(&scheduler->lock);
+	}
+
+	scheduler_unlock(thread);
+
+	if (need_ipi) {
+		ipi_one(IPI_REASON_RESCHEDULE, affinity);
+	}
+}
+
+uint64_result_t
+scheduler_fprr_get_stats(thread_t *thread, cpu_index_t cpu,
+			 scheduler_stat_t stat, index_t index)
+{
+	uint64_result_t ret;
+
+#if defined(SCHEDULER_FPRR_LATENCY_STATS)
+	scheduler_stats_t *stats;
+
+	if (thread != NULL) {
+		stats = &thread->scheduler_stats;
+	} else if (cpulocal_index_valid(cpu)) {
+		stats = &CPULOCAL_BY_INDEX(scheduler, cpu).stats;
+	} else {
+		ret = uint64_result_error(ERROR_ARGUMENT_INVALID);
+		goto out;
+	}
+#else
+	if ((thread == NULL) && !cpulocal_index_valid(cpu)) {
+		ret = uint64_result_error(ERROR_ARGUMENT_INVALID);
+		goto out;
+	}
+#endif
+
+	switch (stat) {
+	case SCHEDULER_STAT_WAKEUP_LATENCY:
+	case SCHEDULER_STAT_RUNQUEUE_WAIT:
+	case SCHEDULER_STAT_MIGRATION_LATENCY:
+#if defined(SCHEDULER_FPRR_LATENCY_STATS)
+		if (index >= SCHEDULER_STATS_NUM_BUCKETS) {
+			ret = uint64_result_error(ERROR_ARGUMENT_INVALID);
+		} else {
+			_Atomic count_t *hist =
+				(stat == SCHEDULER_STAT_WAKEUP_LATENCY)
+					? stats->wakeup
+				: (stat == SCHEDULER_STAT_RUNQUEUE_WAIT)
+					? stats->wait
+					: stats->migrate;
+			ret = uint64_result_ok(atomic_load_relaxed(&hist[index]));
+		}
+#else
+		ret = uint64_result_error(ERROR_UNIMPLEMENTED);
+#endif
+		break;
+	case SCHEDULER_STAT_PREEMPTIONS:
+#if defined(SCHEDULER_FPRR_LATENCY_STATS)
+		if (index != 0U) {
+			ret = uint64_result_error(ERROR_ARGUMENT_INVALID);
+		} else {
+			ret = uint64_result_ok(
+				atomic_load_relaxed(&stats->preemptions));
+		}
+#else
+		ret = uint64_result_error(ERROR_UNIMPLEMENTED);
+#endif
+		break;
+	case SCHEDULER_STAT_QUOTA_USED:
+		// Quota statistics are only kept per thread.
+		if ((thread == NULL) || (index != 0U)) {
+			ret = uint64_result_error(ERROR_ARGUMENT_INVALID);
+		} else {
+			ret = uint64_result_ok(timer_convert_ticks_to_ns(
+				atomic_load_relaxed(&thread->scheduler_quota_used)));
+		}
+		break;
+	case SCHEDULER_STAT_QUOTA_THROTTLED:
+		if ((thread == NULL) || (index != 0U)) {
+			ret = uint64_result_error(ERROR_ARGUMENT_INVALID);
+		} else {
+			ret = uint64_result_ok(atomic_load_relaxed(
+				&thread->scheduler_quota_throttled));
+		}
+		break;
+	case SCHEDULER_STAT_IRQ_BOOSTS:
+	case SCHEDULER_STAT_IRQ_BOOSTS_EXPIRED:
+		// Boost statistics are only kept per thread.
+		if ((thread == NULL) || (index != 0U)) {
+			ret = uint64_result_error(ERROR_ARGUMENT_INVALID);
+		} else {
+			_Atomic count_t *count =
+				(stat == SCHEDULER_STAT_IRQ_BOOSTS)
+					? &thread->scheduler_irq_boosts
+					: &thread->scheduler_irq_boosts_expired;
+			ret = uint64_result_ok(atomic_load_relaxed(count));
+		}
+		break;
+	default:
+		ret = uint64_result_error(ERROR_ARGUMENT_INVALID);
+		break;
+	}
+
+out:
+	return ret;
+}
+
+error_t
+scheduler_set_deadline(thread_t *thread, nanoseconds_t period,
+		       nanoseconds_t budget, nanoseconds_t deadline)
+{
+	error_t err = OK;
+
+	assert_spinlock_held(&thread->scheduler_lock);
+
+	uint32_t bw = 0U;
+	if (period != 0U) {
+		if ((period < SCHEDULER_MIN_DEADLINE_PERIOD) ||
+		    (period > SCHEDULER_MAX_DEADLINE_PERIOD) ||
+		    (budget < SCHEDULER_MIN_DEADLINE_BUDGET) ||
+		    (budget > deadline) || (deadline > period)) {
+			err = ERROR_ARGUMENT_INVALID;
+			goto out;
+		}
+
+		// Round the bandwidth up, so rounding errors can't allow
+		// the CPU to be over-committed.
+		bw = (uint32_t)(((budget << SCHEDULER_DEADLINE_BW_SHIFT) +
+				 (period - 1U)) /
+				period);
+	} else if ((budget != 0U) || (deadline != 0U)) {
+		err = ERROR_ARGUMENT_INVALID;
+		goto out;
+	} else {
+		// Clearing the reservation.
+	}
+
+	cpu_index_t affinity = thread->scheduler_affinity;
+	bool	    reserve  = (bw != 0U) && cpulocal_index_valid(affinity) &&
+			   !sched_state_get_exited(&thread->scheduler_state);
+	bool	    reserved =
+		sched_state_get_deadline_reserved(&thread->scheduler_state);
+
+	// Replace the old reservation in a single update, so a failed
+	// admission leaves it in place.
+	if (reserve) {
+		uint32_t old_bw = reserved ? thread->scheduler_deadline_bw : 0U;
+		if (!deadline_admit(affinity, old_bw, bw)) {
+			err = ERROR_NORESOURCES;
+			goto out;
+		}
+	} else if (reserved) {
+		deadline_release(affinity, thread->scheduler_deadline_bw);
+	} else {
+		// No reservation needed.
+	}
+	sched_state_set_deadline_reserved(&thread->scheduler_state, reserve);
+
+	bool requeue = begin_sched_params_update(thread);
+
+	thread->scheduler_deadline_period   = timer_convert_ns_to_ticks(period);
+	thread->scheduler_deadline_budget   = timer_convert_ns_to_ticks(budget);
+	thread->scheduler_deadline_relative = timer_convert_ns_to_ticks(deadline);
+	thread->scheduler_deadline_bw	    = bw;
+
+	// Start a new period the next time the thread is queued.
+	thread->scheduler_deadline_remaining = 0U;
+	thread->scheduler_deadline_release   = 0U;
+
+	end_sched_params_update(thread, requeue);
+
+out:
+	return err;
+}
+
+error_t
+scheduler_set_quota(thread_t *thread, nanoseconds_t period,
+		    nanoseconds_t budget)
+{
+	error_t err = OK;
+
+	assert_spinlock_held(&thread->scheduler_lock);
+
+	if (period != 0U) {
+		if ((period < SCHEDULER_MIN_QUOTA_PERIOD) ||
+		    (period > SCHEDULER_MAX_QUOTA_PERIOD) ||
+		    (budget < SCHEDULER_MIN_QUOTA_BUDGET) || (budget > period)) {
+			err = ERROR_ARGUMENT_INVALID;
+			goto out;
+		}
+	} else if (budget != 0U) {
+		err = ERROR_ARGUMENT_INVALID;
+		goto out;
+	} else {
+		// Clearing the quota.
+	}
+
+	// The quota can only be changed while the thread is not running, so
+	// its timer can't be queued.
+	if (sched_state_get_running(&thread->scheduler_state) ||
+	    scheduler_is_blocked(thread, SCHEDULER_BLOCK_QUOTA_THROTTLED)) {
+		err = ERROR_BUSY;
+		goto out;
+	}
+
+	thread->scheduler_quota_period = timer_convert_ns_to_ticks(period);
+	thread->scheduler_quota_budget = timer_convert_ns_to_ticks(budget);
+
+	// Start a new period the next time the thread runs.
+	thread->scheduler_quota_remaining = 0U;
+	thread->scheduler_quota_release	  = 0U;
+
+out:
+	return err;
+}
+
 bool
 scheduler_will_preempt_current(thread_t *thread)
 {
 	assert_spinlock_held(&thread->scheduler_lock);
 	thread_t *current = thread_get_self();
+	bool	  preempt;
+
+	if (current->kind == THREAD_KIND_IDLE) {
+		preempt = true;
+	} else if (has_deadline_budget(thread) ||
+		   has_deadline_budget(current)) {
+		preempt = has_deadline_budget(thread) &&
+			  (!has_deadline_budget(current) ||
+			   (thread->scheduler_deadline_absolute <
+			    current->scheduler_deadline_absolute));
+	} else {
+		preempt = get_priority(thread) > get_priority(current);
+	}
 
-	return (thread->scheduler_priority > current->scheduler_priority) ||
-	       (current->kind == THREAD_KIND_IDLE);
+	return preempt;
 }
 
 void
@@ -1343,6 +2946,7 @@ scheduler_fprr_handle_thread_exited(void)
 	assert(!sched_state_get_queued(&thread->scheduler_state));
 
 	sched_state_set_exited(&thread->scheduler_state, true);
+	release_deadline_reservation(thread);
 
 	scheduler_unlock_nopreempt(thread);
 }
@@ -30,8 +30,12 @@
 #include "event_handlers.h"
 
 #define NUM_AFFINITY_SWITCH 20U
+#define NUM_REMOTE_WAKEUPS  100U
 
-#define SCHED_TEST_STACK_AREA (4U << 20)
+// Time to wait for a remotely woken thread to run before failing the test.
+#define REMOTE_WAKEUP_TIMEOUT_NS 100000000U
+
+#define SCHED_TEST_STACK_AREA (8U << 20)
 
 static uintptr_t	 sched_test_stack_base;
 static uintptr_t	 sched_test_stack_end;
@@ -39,11 +43,34 @@ static _Atomic uintptr_t sched_test_stack_alloc;
 
 static _Atomic count_t sync_flag;
 
+static thread_t *_Atomic remote_wake_idler;
+static _Atomic bool	 remote_wake_stop;
+static _Atomic count_t	 remote_wake_seq;
+
 CPULOCAL_DECLARE_STATIC(_Atomic uint8_t, wait_flag);
 CPULOCAL_DECLARE_STATIC(thread_t *, test_thread);
 CPULOCAL_DECLARE_STATIC(count_t, test_passed_count);
 CPULOCAL_DECLARE_STATIC(_Atomic count_t, affinity_count);
 
+#if defined(SCHEDULER_FPRR_BENCHMARK)
+#define NUM_BENCH_SAMPLES 256U
+
+// The benchmarks are run by CPU 0 while the other CPUs wait, so the results
+// are not disturbed by the other tests.
+static ticks_t		bench_samples[NUM_BENCH_SAMPLES];
+static thread_t	       *bench_parent;
+static _Atomic bool	bench_stop;
+static _Atomic count_t	bench_seq;
+static _Atomic ticks_t	bench_end;
+static _Atomic count_t	bench_done;
+
+static _Atomic count_t remote_wakeup_sync;
+static _Atomic count_t remote_wakeup_done;
+
+CPULOCAL_DECLARE_STATIC(_Atomic count_t, wakeup_bench_seq);
+CPULOCAL_DECLARE_STATIC(_Atomic ticks_t, wakeup_bench_end);
+#endif
+
 static thread_ptr_result_t
 create_thread(priority_t prio, cpu_index_t cpu, sched_test_op_t op)
 	REQUIRE_PREEMPT_DISABLED
@@ -111,6 +138,342 @@ schedule_check_switched(thread_t *thread, bool switch_expected)
 	preempt_enable();
 }
 
+#if SCHEDULER_CAN_MIGRATE
+static void
+remote_wakeup_test(void) REQUIRE_PREEMPT_DISABLED
+{
+	// CPU 1 goes idle by blocking its test thread, and CPU 0 repeatedly
+	// wakes a thread with affinity for CPU 1. The idle CPU only runs the
+	// thread if the wakeup sends it an IPI, so a lost IPI leaves the
+	// thread blocked until the timeout.
+	cpu_index_t cpu	 = cpulocal_get_index();
+	thread_t   *self = thread_get_self();
+
+	if (!cpulocal_index_valid(1U) || (cpu > 1U)) {
+		goto out;
+	}
+
+	if (cpu == 1U) {
+		scheduler_lock_nopreempt(self);
+		scheduler_block(self, SCHEDULER_BLOCK_SCHED_TEST);
+		scheduler_unlock_nopreempt(self);
+		atomic_store_release(&remote_wake_idler, self);
+
+		// This returns once CPU 0 has finished and unblocked us.
+		scheduler_yield();
+		goto out;
+	}
+
+	thread_t *idler;
+	bool	  idler_running = true;
+	do {
+		idler = atomic_load_acquire(&remote_wake_idler);
+		if (idler != NULL) {
+			scheduler_lock_nopreempt(idler);
+			idler_running = scheduler_is_running(idler);
+			scheduler_unlock_nopreempt(idler);
+		}
+	} while (idler_running);
+
+	thread_ptr_result_t ret = create_thread(SCHEDULER_DEFAULT_PRIORITY, 1U,
+						SCHED_TEST_OP_REMOTE_WAKE);
+	assert(ret.e == OK);
+
+	thread_t *thread  = ret.r;
+	ticks_t	  timeout = timer_convert_ns_to_ticks(REMOTE_WAKEUP_TIMEOUT_NS);
+
+	for (count_t i = 0U; i <= NUM_REMOTE_WAKEUPS; i++) {
+		bool thread_running = true;
+		while (thread_running) {
+			scheduler_lock_nopreempt(thread);
+			thread_running =
+				!scheduler_is_blocked(
+					thread, SCHEDULER_BLOCK_SCHED_TEST) ||
+				scheduler_is_running(thread);
+			scheduler_unlock_nopreempt(thread);
+		}
+
+		if (i == NUM_REMOTE_WAKEUPS) {
+			atomic_store_relaxed(&remote_wake_stop, true);
+		}
+
+		scheduler_lock_nopreempt(thread);
+		bool need_schedule =
+			scheduler_unblock(thread, SCHEDULER_BLOCK_SCHED_TEST);
+		scheduler_unlock_nopreempt(thread);
+
+		if (need_schedule) {
+			scheduler_trigger();
+		}
+
+		ticks_t start = timer_get_current_timer_ticks();
+		while (atomic_load_acquire(&remote_wake_seq) == i) {
+			if ((timer_get_current_timer_ticks() - start) >
+			    timeout) {
+				panic("Remote wakeup was not delivered");
+			}
+		}
+	}
+
+	destroy_thread(thread);
+
+	scheduler_lock_nopreempt(idler);
+	if (scheduler_unblock(idler, SCHEDULER_BLOCK_SCHED_TEST)) {
+		scheduler_trigger();
+	}
+	scheduler_unlock_nopreempt(idler);
+
+out:
+	return;
+}
+#endif
+
+#if defined(SCHEDULER_FPRR_BENCHMARK)
+static void
+bench_report(const char *name)
+{
+	// Insertion sort; there are few enough samples for this to be fine.
+	for (index_t i = 1U; i < NUM_BENCH_SAMPLES; i++) {
+		ticks_t sample = bench_samples[i];
+		index_t j      = i;
+		while ((j > 0U) && (bench_samples[j - 1U] > sample)) {
+			bench_samples[j] = bench_samples[j - 1U];
+			j--;
+		}
+		bench_samples[j] = sample;
+	}
+
+	LOG(DEBUG, INFO,
+	    "sched bench {:s}: min {:d} median {:d} p99 {:d} max {:d} ticks",
+	    (register_t)name, bench_samples[0],
+	    bench_samples[NUM_BENCH_SAMPLES / 2U],
+	    bench_samples[(NUM_BENCH_SAMPLES * 99U) / 100U],
+	    bench_samples[NUM_BENCH_SAMPLES - 1U]);
+}
+
+static thread_t *
+bench_create_thread(priority_t prio, cpu_index_t cpu, sched_test_op_t op)
+	REQUIRE_PREEMPT_DISABLED
+{
+	atomic_store_relaxed(&bench_stop, false);
+	atomic_store_relaxed(&bench_seq, 0U);
+
+	thread_ptr_result_t ret = create_thread(prio, cpu, op);
+	assert(ret.e == OK);
+
+	return ret.r;
+}
+
+static void
+bench_yield(void) REQUIRE_PREEMPT_DISABLED
+{
+	// Yield with no other runnable threads.
+	for (index_t i = 0U; i < NUM_BENCH_SAMPLES; i++) {
+		ticks_t start = timer_get_current_timer_ticks();
+		scheduler_yield();
+		bench_samples[i] = timer_get_current_timer_ticks() - start;
+	}
+	bench_report("yield");
+
+	// Yield to a thread of the same priority, which yields straight back;
+	// this is two context switches.
+	thread_t *thread =
+		bench_create_thread(SCHEDULER_DEFAULT_PRIORITY,
+				    cpulocal_get_index(), SCHED_TEST_OP_BENCH_YIELD);
+	for (index_t i = 0U; i < NUM_BENCH_SAMPLES; i++) {
+		ticks_t start = timer_get_current_timer_ticks();
+		scheduler_yield();
+		bench_samples[i] = timer_get_current_timer_ticks() - start;
+	}
+	bench_report("switch round trip");
+
+	atomic_store_relaxed(&bench_stop, true);
+	destroy_thread(thread);
+}
+
+static void
+bench_yield_to(void) REQUIRE_PREEMPT_DISABLED
+{
+	// Directed yield to a thread that only runs when yielded to, and
+	// which yields straight back.
+	thread_t *thread = bench_create_thread(SCHEDULER_MIN_PRIORITY,
+					       CPU_INDEX_INVALID,
+					       SCHED_TEST_OP_BENCH_YIELDTO);
+	for (index_t i = 0U; i < NUM_BENCH_SAMPLES; i++) {
+		ticks_t start = timer_get_current_timer_ticks();
+		scheduler_yield_to(thread);
+		bench_samples[i] = timer_get_current_timer_ticks() - start;
+	}
+	bench_report("yield_to round trip");
+
+	atomic_store_relaxed(&bench_stop, true);
+	destroy_thread(thread);
+}
+
+static ticks_t
+bench_wake_thread(thread_t *thread, cpu_index_t target)
+	REQUIRE_PREEMPT_DISABLED
+{
+	// Wait for the thread to block itself and switch away.
+	while (!scheduler_is_blocked(thread, SCHEDULER_BLOCK_SCHED_TEST) ||
+	       scheduler_is_running(thread)) {
+		scheduler_yield();
+	}
+
+	ticks_t start = timer_get_current_timer_ticks();
+
+	scheduler_lock_nopreempt(thread);
+	if (scheduler_get_affinity(thread) != target) {
+		error_t err = scheduler_set_affinity(thread, target);
+		assert(err == OK);
+	}
+	bool need_schedule =
+		scheduler_unblock(thread, SCHEDULER_BLOCK_SCHED_TEST);
+	scheduler_unlock_nopreempt(thread);
+
+	if (need_schedule) {
+		scheduler_trigger();
+	}
+
+	return start;
+}
+
+static void
+bench_wakeup(const char *name, cpu_index_t cpu_a, cpu_index_t cpu_b)
+	REQUIRE_PREEMPT_DISABLED
+{
+	// Measure the time from unblocking a thread until it runs. If the two
+	// CPUs differ, the thread is also moved between them while blocked.
+	thread_t *thread = bench_create_thread(SCHEDULER_MAX_PRIORITY, cpu_a,
+					       SCHED_TEST_OP_BENCH_WAKE);
+	for (index_t i = 0U; i < NUM_BENCH_SAMPLES; i++) {
+		cpu_index_t target = ((i % 2U) == 0U) ? cpu_b : cpu_a;
+		ticks_t	    start  = bench_wake_thread(thread, target);
+
+		while (atomic_load_acquire(&bench_seq) == i) {
+			scheduler_yield();
+		}
+
+		bench_samples[i] = atomic_load_relaxed(&bench_end) - start;
+	}
+	bench_report(name);
+
+	atomic_store_relaxed(&bench_stop, true);
+	scheduler_lock_nopreempt(thread);
+	cpu_index_t affinity = scheduler_get_affinity(thread);
+	scheduler_unlock_nopreempt(thread);
+	(void)bench_wake_thread(thread, affinity);
+	destroy_thread(thread);
+}
+
+#if SCHEDULER_CAN_MIGRATE
+static void
+remote_wakeup_benchmark(void) REQUIRE_PREEMPT_DISABLED
+{
+	// Every CPU repeatedly wakes its own thread on CPU 0 at the same time,
+	// so the wakeups contend on CPU 0's scheduler. This is run on all CPUs,
+	// unlike the benchmarks in scheduler_benchmarks().
+	cpu_index_t target = 0U;
+
+	thread_ptr_result_t ret = create_thread(
+		SCHEDULER_DEFAULT_PRIORITY, target, SCHED_TEST_OP_WAKEUP_BENCH);
+	assert(ret.e == OK);
+
+	thread_t *thread    = ret.r;
+	ticks_t	  total	    = 0U;
+	ticks_t	  max_ticks = 0U;
+
+	(void)atomic_fetch_add_explicit(&remote_wakeup_sync, 1U,
+					memory_order_relaxed);
+	while (asm_event_load_before_wait(&remote_wakeup_sync) <
+	       PLATFORM_MAX_CORES) {
+		asm_event_wait(&remote_wakeup_sync);
+	}
+
+	_Atomic count_t *seq = &CPULOCAL(wakeup_bench_seq);
+	_Atomic ticks_t *end = &CPULOCAL(wakeup_bench_end);
+
+	for (count_t i = 0U; i < NUM_REMOTE_WAKEUPS; i++) {
+		// Wait for the thread to block itself.
+		while (!scheduler_is_blocked(thread,
+					     SCHEDULER_BLOCK_SCHED_TEST)) {
+			scheduler_yield();
+		}
+
+		ticks_t start = timer_get_current_timer_ticks();
+		scheduler_lock_nopreempt(thread);
+		bool need_schedule =
+			scheduler_unblock(thread, SCHEDULER_BLOCK_SCHED_TEST);
+		scheduler_unlock_nopreempt(thread);
+
+		if (need_schedule) {
+			scheduler_trigger();
+		}
+
+		// Wait for the thread to run, and measure the time until it
+		// did, including delivery of the wakeup to CPU 0.
+		while (atomic_load_acquire(seq) == i) {
+			scheduler_yield();
+		}
+		ticks_t elapsed = atomic_load_relaxed(end) - start;
+
+		total += elapsed;
+		max_ticks = util_max(max_ticks, elapsed);
+	}
+
+	LOG(DEBUG, INFO,
+	    "sched bench remote wakeup: CPU {:d} -> {:d}: avg {:d}ns, "
+	    "max {:d}ns",
+	    cpulocal_get_index(), target,
+	    timer_convert_ticks_to_ns(total / NUM_REMOTE_WAKEUPS),
+	    timer_convert_ticks_to_ns(max_ticks));
+
+	destroy_thread(thread);
+	assert(atomic_load_relaxed(seq) == NUM_REMOTE_WAKEUPS);
+
+	// All of the threads run on CPU 0, so it must keep yielding to them
+	// until they have all exited; the tests that follow spin with
+	// preemption disabled.
+	(void)atomic_fetch_add_explicit(&remote_wakeup_done, 1U,
+					memory_order_release);
+	while (atomic_load_acquire(&remote_wakeup_done) < PLATFORM_MAX_CORES) {
+		scheduler_yield();
+	}
+}
+#endif
+
+static void
+scheduler_benchmarks(void) REQUIRE_PREEMPT_DISABLED
+{
+	if (cpulocal_get_index() != 0U) {
+		// Wait, with preemption enabled so the benchmark threads can
+		// run here, until CPU 0 has finished.
+		preempt_enable();
+		while (asm_event_load_before_wait(&bench_done) == 0U) {
+			asm_event_wait(&bench_done);
+		}
+		preempt_disable();
+		goto out;
+	}
+
+	bench_parent = thread_get_self();
+
+	bench_yield();
+	bench_yield_to();
+
+#if SCHEDULER_CAN_MIGRATE
+	if (cpulocal_index_valid(1U)) {
+		bench_wakeup("remote wakeup", 1U, 1U);
+		bench_wakeup("migrate and wakeup", 0U, 1U);
+	}
+#endif
+
+	asm_event_store_and_wake(&bench_done, 1U);
+out:
+	return;
+}
+#endif
+
 void
 tests_scheduler_init(void)
 {
@@ -266,6 +629,18 @@ tests_scheduler_start(void)
 
 	destroy_thread(ret.r);
 	CPULOCAL(test_passed_count)++;
+
+	// Test 6: remote wakeups of an idle CPU
+	remote_wakeup_test();
+	CPULOCAL(test_passed_count)++;
+
+#if defined(SCHEDULER_FPRR_BENCHMARK)
+	remote_wakeup_benchmark();
+#endif
+#endif
+
+#if defined(SCHEDULER_FPRR_BENCHMARK)
+	scheduler_benchmarks();
 #endif
 
 	return false;
@@ -310,6 +685,66 @@ sched_test_thread_entry(uintptr_t param)
 		}
 		break;
 	}
+	case SCHED_TEST_OP_REMOTE_WAKE: {
+		thread_t *self = thread_get_self();
+		while (!atomic_load_relaxed(&remote_wake_stop)) {
+			scheduler_lock(self);
+			scheduler_block(self, SCHEDULER_BLOCK_SCHED_TEST);
+			scheduler_unlock(self);
+			scheduler_yield();
+
+			(void)atomic_fetch_add_explicit(&remote_wake_seq, 1U,
+							memory_order_release);
+		}
+		break;
+	}
+#if defined(SCHEDULER_FPRR_BENCHMARK)
+	case SCHED_TEST_OP_WAKEUP_BENCH: {
+		thread_t   *self   = thread_get_self();
+		cpu_index_t parent = sched_test_param_get_parent(&test_param);
+		for (count_t i = 0U; i < NUM_REMOTE_WAKEUPS; i++) {
+			scheduler_lock(self);
+			scheduler_block(self, SCHEDULER_BLOCK_SCHED_TEST);
+			scheduler_unlock(self);
+			scheduler_yield();
+
+			// We have been woken; record the time.
+			atomic_store_relaxed(
+				&CPULOCAL_BY_INDEX(wakeup_bench_end, parent),
+				timer_get_current_timer_ticks());
+			(void)atomic_fetch_add_explicit(
+				&CPULOCAL_BY_INDEX(wakeup_bench_seq, parent),
+				1U, memory_order_release);
+		}
+		break;
+	}
+	case SCHED_TEST_OP_BENCH_YIELD:
+		while (!atomic_load_relaxed(&bench_stop)) {
+			scheduler_yield();
+		}
+		break;
+	case SCHED_TEST_OP_BENCH_YIELDTO:
+		while (!atomic_load_relaxed(&bench_stop)) {
+			scheduler_yield_to(bench_parent);
+		}
+		break;
+	case SCHED_TEST_OP_BENCH_WAKE: {
+		thread_t *self = thread_get_self();
+		while (!atomic_load_relaxed(&bench_stop)) {
+			scheduler_lock(self);
+			scheduler_block(self, SCHEDULER_BLOCK_SCHED_TEST);
+			scheduler_unlock(self);
+			scheduler_yield();
+
+			// We have been woken; record the time.
+			atomic_store_relaxed(&bench_end,
+					     timer_get_current_timer_ticks());
+			(void)atomic_fetch_add_explicit(&bench_seq, 1U,
+							memory_order_release);
+		}
+		break;
+	}
+#endif
 	default:
 		panic("Invalid param for sched test thread!");
 	}
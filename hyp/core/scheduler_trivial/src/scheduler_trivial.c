@@ -305,6 +305,27 @@ scheduler_get_primary_vcpu(cpu_index_t cpu)
 	return atomic_load_consume(&CPULOCAL_BY_INDEX(active_thread, cpu));
 }
 
+bool
+scheduler_is_cpu_isolated(cpu_index_t cpu)
+{
+	(void)cpu;
+	return false;
+}
+
+cpu_index_t
+scheduler_get_housekeeping_cpu(cpu_index_t cpu)
+{
+	return cpu;
+}
+
+error_t
+scheduler_set_cpu_isolated(cpu_index_t cpu, bool isolated)
+{
+	(void)cpu;
+	(void)isolated;
+	return ERROR_UNIMPLEMENTED;
+}
+
 void
 scheduler_pin(thread_t *thread)
 {
@@ -0,0 +1,207 @@
+// © 2021 Qualcomm Innovation Center, Inc. All rights reserved.
+//
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <assert.h>
+#include <hyptypes.h>
+
+#include <atomic.h>
+#include <compiler.h>
+#include <cpulocal.h>
+#include <preempt.h>
+#include <spinlock.h>
+
+#include <events/spinlock.h>
+
+#include <asm/barrier.h>
+#include <asm/event.h>
+
+// Queued (MCS-style) spinlock implementation, for multiprocessor builds with
+// enough CPUs that contended ticket locks cause excessive cache line traffic.
+//
+// An uncontended lock is acquired and released with a single atomic operation
+// on the lock word. A contended acquire appends the CPU's node to a queue and
+// polls only that node, so a release disturbs the first waiter, rather than
+// every waiter. The first waiter polls the lock word. Once it has taken the
+// lock it passes the head of the queue to the next waiter, and its node is
+// free again. Locks are handed over in FIFO order, as for ticket locks.
+//
+// Spinlocks are only acquired with interrupts disabled, so a CPU never waits
+// for more than one lock at a time, and one node per CPU is enough. This is
+// not true for abort handlers, which therefore must not acquire a spinlock
+// unless the abort is fatal.
+
+#define SPINLOCK_HELD	    ((uint32_t)1U)
+#define SPINLOCK_TAIL_SHIFT 16U
+#define SPINLOCK_TAIL_MASK  ((uint32_t)0xffff0000U)
+
+static_assert(PLATFORM_MAX_CORES < 0xffffU,
+	      "CPU indices must fit in the spinlock tail");
+
+CPULOCAL_DECLARE_STATIC(spinlock_node_t, spinlock_node);
+
+static uint32_t
+spinlock_tail_for_cpu(cpu_index_t cpu)
+{
+	return ((uint32_t)cpu + 1U) << SPINLOCK_TAIL_SHIFT;
+}
+
+static spinlock_node_t *
+spinlock_tail_node(uint32_t state)
+{
+	cpu_index_t cpu = (cpu_index_t)((state >> SPINLOCK_TAIL_SHIFT) - 1U);
+
+	return &CPULOCAL_BY_INDEX(spinlock_node, cpu);
+}
+
+void
+spinlock_init(spinlock_t *lock)
+{
+	atomic_init(&lock->state, 0U);
+	trigger_spinlock_init_event(lock);
+}
+
+void
+spinlock_acquire(spinlock_t *lock)
+{
+	preempt_disable();
+	spinlock_acquire_nopreempt(lock);
+}
+
+static void
+spinlock_acquire_queued(spinlock_t *lock) REQUIRE_PREEMPT_DISABLED
+{
+	spinlock_node_t *node = &CPULOCAL(spinlock_node);
+	uint32_t	 tail = spinlock_tail_for_cpu(cpulocal_get_index());
+
+	atomic_store_relaxed(&node->next, NULL);
+	atomic_store_relaxed(&node->wait, true);
+
+	// Make our node the tail of the queue. This releases the node's
+	// initialisation to the next waiter, and acquires the previous tail's
+	// node.
+	uint32_t state = atomic_load_relaxed(&lock->state);
+	uint32_t new_state;
+	do {
+		new_state = (state & ~SPINLOCK_TAIL_MASK) | tail;
+	} while (!atomic_compare_exchange_weak_explicit(
+		&lock->state, &state, new_state, memory_order_acq_rel,
+		memory_order_relaxed));
+
+	if ((state & SPINLOCK_TAIL_MASK) != 0U) {
+		// Link behind the previous tail, and wait for it to pass us the
+		// head of the queue.
+		spinlock_node_t *prev = spinlock_tail_node(state);
+		atomic_store_release(&prev->next, node);
+
+		while (asm_event_load_before_wait(&node->wait)) {
+			asm_event_wait(&node->wait);
+		}
+	}
+
+	// We are at the head of the queue; wait for the lock to be released.
+	state = asm_event_load_before_wait(&lock->state);
+	while ((state & SPINLOCK_HELD) != 0U) {
+		asm_event_wait(&lock->state);
+		state = asm_event_load_before_wait(&lock->state);
+	}
+
+	// Nobody else can take the lock while the queue is not empty. If we
+	// are the only waiter, take the lock and empty the queue together.
+	if (((state & SPINLOCK_TAIL_MASK) != tail) ||
+	    !atomic_compare_exchange_strong_explicit(
+		    &lock->state, &state, SPINLOCK_HELD, memory_order_acquire,
+		    memory_order_relaxed)) {
+		// There is at least one waiter behind us. Take the lock, then
+		// pass the head of the queue to the next waiter once it has
+		// linked itself to our node.
+		(void)atomic_fetch_or_explicit(&lock->state, SPINLOCK_HELD,
+					       memory_order_acquire);
+
+		spinlock_node_t *next = atomic_load_acquire(&node->next);
+		while (next == NULL) {
+			asm_yield();
+			next = atomic_load_acquire(&node->next);
+		}
+
+		asm_event_store_and_wake(&next->wait, false);
+	}
+}
+
+void
+spinlock_acquire_nopreempt(spinlock_t *lock) LOCK_IMPL
+{
+	trigger_spinlock_acquire_event(lock);
+
+	uint32_t state = 0U;
+	if (compiler_unexpected(!atomic_compare_exchange_strong_explicit(
+		    &lock->state, &state, SPINLOCK_HELD, memory_order_acquire,
+		    memory_order_relaxed))) {
+		trigger_spinlock_contended_event(lock);
+		spinlock_acquire_queued(lock);
+	}
+
+	trigger_spinlock_acquired_event(lock);
+}
+
+bool
+spinlock_trylock(spinlock_t *lock)
+{
+	bool success;
+
+	preempt_disable();
+	success = spinlock_trylock_nopreempt(lock);
+	if (!success) {
+		preempt_enable();
+	}
+
+	return success;
+}
+
+bool
+spinlock_trylock_nopreempt(spinlock_t *lock) LOCK_IMPL
+{
+	trigger_spinlock_acquire_event(lock);
+
+	// Take the lock, but only if it is free and nobody is waiting for it
+	uint32_t state	 = 0U;
+	bool	 success = atomic_compare_exchange_strong_explicit(
+		&lock->state, &state, SPINLOCK_HELD, memory_order_acquire,
+		memory_order_relaxed);
+
+	if (success) {
+		trigger_spinlock_acquired_event(lock);
+	} else {
+		trigger_spinlock_failed_event(lock);
+	}
+	return success;
+}
+
+void
+spinlock_release(spinlock_t *lock)
+{
+	spinlock_release_nopreempt(lock);
+	preempt_enable();
+}
+
+void
+spinlock_release_nopreempt(spinlock_t *lock) LOCK_IMPL
+{
+	trigger_spinlock_release_event(lock);
+
+	// The tail may be changed concurrently by new waiters, so the held
+	// flag must be cleared atomically. Only the head of the queue, if
+	// any, is waiting for this.
+	(void)atomic_fetch_and_explicit(&lock->state, ~SPINLOCK_HELD,
+					memory_order_release);
+	asm_event_wake_updated();
+
+	trigger_spinlock_released_event(lock);
+}
+
+void
+assert_spinlock_held(const spinlock_t *lock)
+{
+	assert_preempt_disabled();
+	trigger_spinlock_assert_held_event(lock);
+}
@@ -5,6 +5,7 @@
 #include <hyptypes.h>
 
 #include <atomic.h>
+#include <compiler.h>
 #include <preempt.h>
 #include <spinlock.h>
 
@@ -42,8 +43,14 @@ spinlock_acquire_nopreempt(spinlock_t *lock) LOCK_IMPL
 						       memory_order_relaxed);
 
 	// Wait until our ticket is being served
-	while (asm_event_load_before_wait(&lock->now_serving) != my_ticket) {
-		asm_event_wait(&lock->now_serving);
+	if (compiler_unexpected(atomic_load_acquire(&lock->now_serving) !=
+				my_ticket)) {
+		trigger_spinlock_contended_event(lock);
+
+		while (asm_event_load_before_wait(&lock->now_serving) !=
+		       my_ticket) {
+			asm_event_wait(&lock->now_serving);
+		}
 	}
 
 	trigger_spinlock_acquired_event(lock);
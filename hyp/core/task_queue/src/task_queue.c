@@ -5,10 +5,12 @@
 #include <assert.h>
 #include <hyptypes.h>
 
+#include <compiler.h>
 #include <cpulocal.h>
 #include <ipi.h>
 #include <preempt.h>
 #include <rcu.h>
+#include <scheduler.h>
 #include <spinlock.h>
 #include <task_queue.h>
 
@@ -50,7 +52,18 @@ task_queue_schedule(task_queue_entry_t *entry)
 	}
 
 	cpulocal_begin();
-	cpu_index_t cpu = cpulocal_get_index();
+	cpu_index_t cpu	  = cpulocal_get_index();
+	bool	    local = true;
+
+	// Isolated CPUs hand their tasks to a housekeeping CPU.
+	if (compiler_unexpected(scheduler_is_cpu_isolated(cpu))) {
+		cpu_index_t target = scheduler_get_housekeeping_cpu(cpu);
+		if (cpulocal_index_valid(target)) {
+			cpu   = target;
+			local = false;
+		}
+	}
+
 	spinlock_acquire_nopreempt(&CPULOCAL_BY_INDEX(task_queue_lock, cpu));
 
 	task_queue_entry_t *head = &CPULOCAL_BY_INDEX(task_queue_head, cpu);
@@ -65,7 +78,11 @@ task_queue_schedule(task_queue_entry_t *entry)
 	spinlock_release_nopreempt(&CPULOCAL_BY_INDEX(task_queue_lock, cpu));
 	cpulocal_end();
 
-	ipi_one_relaxed(IPI_REASON_TASK_QUEUE, cpu);
+	if (local) {
+		ipi_one_relaxed(IPI_REASON_TASK_QUEUE, cpu);
+	} else {
+		ipi_one(IPI_REASON_TASK_QUEUE, cpu);
+	}
 
 	err = OK;
 out:
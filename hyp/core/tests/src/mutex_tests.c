@@ -0,0 +1,403 @@
+// © 2021 Qualcomm Innovation Center, Inc. All rights reserved.
+//
+// SPDX-License-Identifier: BSD-3-Clause
+
+#if defined(UNIT_TESTS) && defined(MODULE_CORE_MUTEX_BLOCKING)
+
+#include <assert.h>
+#include <hyptypes.h>
+
+#include <atomic.h>
+#include <cpulocal.h>
+#include <hyp_aspace.h>
+#include <log.h>
+#include <mutex.h>
+#include <object.h>
+#include <panic.h>
+#include <partition.h>
+#include <partition_alloc.h>
+#include <preempt.h>
+#include <scheduler.h>
+#include <thread.h>
+#include <timer_queue.h>
+#include <util.h>
+
+#include <asm/event.h>
+
+#include "event_handlers.h"
+
+#define MUTEX_TEST_ITERATIONS 100U
+#define MUTEX_TEST_WAITERS    4U
+
+// Priorities of the threads in the priority inheritance tests, which must be
+// higher than the test thread's.
+#define MUTEX_TEST_PI_LOW    (SCHEDULER_DEFAULT_PRIORITY + 1U)
+#define MUTEX_TEST_PI_MEDIUM (SCHEDULER_DEFAULT_PRIORITY + 2U)
+#define MUTEX_TEST_PI_HIGH   (SCHEDULER_DEFAULT_PRIORITY + 3U)
+
+// Time the medium priority thread waits for the high priority thread to run
+// before deciding that priority inheritance has failed.
+#define MUTEX_TEST_PI_TIMEOUT_NS 100000000U
+
+#define MUTEX_TEST_PI_LOCKS 2U
+
+// Enough stacks for every thread created by the tests below.
+#define MUTEX_TEST_MAX_THREADS 16U
+
+static uintptr_t	 mutex_test_stack_base;
+static uintptr_t	 mutex_test_stack_end;
+static _Atomic uintptr_t mutex_test_stack_alloc;
+
+static mutex_t	       mutex_test_lock;
+static count_t	       mutex_test_count;
+static _Atomic count_t mutex_test_ready;
+static _Atomic count_t mutex_test_done;
+static index_t	       mutex_test_order[MUTEX_TEST_WAITERS];
+static index_t	       mutex_test_order_count;
+
+static mutex_t	    mutex_test_pi_lock[MUTEX_TEST_PI_LOCKS];
+static _Atomic bool mutex_test_pi_done;
+static _Atomic bool mutex_test_pi_inverted;
+
+void
+tests_mutex_init(void)
+{
+	size_t area = THREAD_STACK_MAP_ALIGN * (MUTEX_TEST_MAX_THREADS + 1U);
+
+	virt_range_result_t range = hyp_aspace_allocate(area);
+	if (range.e != OK) {
+		panic("Unable to allocate address space for mutex test stacks");
+	}
+
+	mutex_test_stack_base =
+		util_balign_up(range.r.base + 1U, THREAD_STACK_MAP_ALIGN);
+	mutex_test_stack_end = range.r.base + (range.r.size - 1U);
+	atomic_init(&mutex_test_stack_alloc, mutex_test_stack_base);
+
+	mutex_init(&mutex_test_lock);
+	for (index_t i = 0U; i < MUTEX_TEST_PI_LOCKS; i++) {
+		mutex_init(&mutex_test_pi_lock[i]);
+	}
+}
+
+static thread_t *
+mutex_test_create_thread(priority_t prio, mutex_test_op_t op, index_t index)
+{
+	mutex_test_param_t param = mutex_test_param_default();
+	mutex_test_param_set_op(&param, op);
+	mutex_test_param_set_index(&param, (uint16_t)index);
+
+	thread_create_t params = {
+		.scheduler_affinity	  = cpulocal_get_index(),
+		.scheduler_affinity_valid = true,
+		.scheduler_priority	  = prio,
+		.scheduler_priority_valid = true,
+		.kind			  = THREAD_KIND_MUTEX_TEST,
+		.params			  = mutex_test_param_raw(param),
+	};
+
+	thread_ptr_result_t ret =
+		partition_allocate_thread(partition_get_private(), params);
+	if (ret.e != OK) {
+		panic("Unable to create mutex test thread");
+	}
+
+	if (object_activate_thread(ret.r) != OK) {
+		panic("Error activating mutex test thread");
+	}
+
+	return ret.r;
+}
+
+static void
+mutex_test_wait_blocked(thread_t *thread, scheduler_block_t block)
+{
+	bool blocked = false;
+
+	while (!blocked) {
+		scheduler_lock(thread);
+		blocked = scheduler_is_blocked(thread, block);
+		scheduler_unlock(thread);
+		if (!blocked) {
+			scheduler_yield();
+		}
+	}
+}
+
+static void
+mutex_test_destroy_thread(thread_t *thread)
+{
+	while (atomic_load_relaxed(&thread->state) != THREAD_STATE_EXITED) {
+		scheduler_yield_to(thread);
+	}
+
+	object_put_thread(thread);
+}
+
+// Every core repeatedly increments a shared count with the mutex held, so
+// waiters spin, block and are handed the mutex, and checks that no increment
+// is lost.
+static void
+tests_mutex_contended(void)
+{
+	(void)atomic_fetch_add_explicit(&mutex_test_ready, 1U,
+					memory_order_relaxed);
+	asm_event_wake_updated();
+	while (asm_event_load_before_wait(&mutex_test_ready) !=
+	       PLATFORM_MAX_CORES) {
+		asm_event_wait(&mutex_test_ready);
+	}
+
+	for (count_t i = 0U; i < MUTEX_TEST_ITERATIONS; i++) {
+		mutex_acquire(&mutex_test_lock);
+		mutex_test_count++;
+		mutex_release(&mutex_test_lock);
+	}
+
+	(void)atomic_fetch_add_explicit(&mutex_test_done, 1U,
+					memory_order_relaxed);
+	while (atomic_load_relaxed(&mutex_test_done) != PLATFORM_MAX_CORES) {
+		scheduler_yield();
+	}
+
+	mutex_acquire(&mutex_test_lock);
+	if (mutex_test_count != (MUTEX_TEST_ITERATIONS * PLATFORM_MAX_CORES)) {
+		panic("mutex test: lost update");
+	}
+	mutex_release(&mutex_test_lock);
+}
+
+// Queue several threads on a held mutex, one at a time, and check that they
+// are handed the mutex in the order they queued. The mutex must be handed
+// over on release, so a trylock immediately after releasing it fails.
+static void
+tests_mutex_fifo(void)
+{
+	thread_t *waiters[MUTEX_TEST_WAITERS];
+
+	mutex_acquire(&mutex_test_lock);
+	mutex_test_order_count = 0U;
+
+	for (index_t i = 0U; i < MUTEX_TEST_WAITERS; i++) {
+		waiters[i] = mutex_test_create_thread(
+			SCHEDULER_DEFAULT_PRIORITY, MUTEX_TEST_OP_QUEUE, i);
+		mutex_test_wait_blocked(waiters[i], SCHEDULER_BLOCK_MUTEX);
+	}
+
+	mutex_release(&mutex_test_lock);
+	if (mutex_trylock(&mutex_test_lock)) {
+		panic("mutex test: released mutex was not handed over");
+	}
+
+	for (index_t i = 0U; i < MUTEX_TEST_WAITERS; i++) {
+		mutex_test_destroy_thread(waiters[i]);
+	}
+
+	mutex_acquire(&mutex_test_lock);
+	if (mutex_test_order_count != MUTEX_TEST_WAITERS) {
+		panic("mutex test: missing waiter");
+	}
+	for (index_t i = 0U; i < MUTEX_TEST_WAITERS; i++) {
+		if (mutex_test_order[i] != i) {
+			panic("mutex test: waiters not served in FIFO order");
+		}
+	}
+	mutex_release(&mutex_test_lock);
+}
+
+// Let a low priority thread that owns a mutex continue, at the same time as
+// starting a medium priority thread that spins until a high priority thread
+// waiting for the mutex has run. Without priority inheritance the medium
+// priority thread runs first and times out.
+static thread_t *
+mutex_test_pi_release_owner(thread_t *owner)
+{
+	preempt_disable();
+
+	thread_t *medium = mutex_test_create_thread(
+		MUTEX_TEST_PI_MEDIUM, MUTEX_TEST_OP_PI_MEDIUM, 0U);
+
+	scheduler_lock_nopreempt(owner);
+	if (scheduler_unblock(owner, SCHEDULER_BLOCK_TEST)) {
+		scheduler_trigger();
+	}
+	scheduler_unlock_nopreempt(owner);
+
+	preempt_enable();
+
+	return medium;
+}
+
+// A low priority thread owns a mutex that a high priority thread waits for.
+static void
+tests_mutex_pi_basic(void)
+{
+	atomic_store_relaxed(&mutex_test_pi_done, false);
+	atomic_store_relaxed(&mutex_test_pi_inverted, false);
+
+	thread_t *owner = mutex_test_create_thread(
+		MUTEX_TEST_PI_LOW, MUTEX_TEST_OP_PI_OWNER, 0U);
+	mutex_test_wait_blocked(owner, SCHEDULER_BLOCK_TEST);
+
+	thread_t *high = mutex_test_create_thread(
+		MUTEX_TEST_PI_HIGH, MUTEX_TEST_OP_PI_HIGH, 0U);
+	mutex_test_wait_blocked(high, SCHEDULER_BLOCK_MUTEX);
+
+	thread_t *medium = mutex_test_pi_release_owner(owner);
+
+	mutex_test_destroy_thread(owner);
+	mutex_test_destroy_thread(high);
+	mutex_test_destroy_thread(medium);
+
+	if (atomic_load_relaxed(&mutex_test_pi_inverted)) {
+		panic("mutex test: owner not boosted by waiter");
+	}
+}
+
+// The high priority thread waits for a mutex whose owner is queued behind
+// another low priority thread on a second mutex. The high priority thread
+// boosts the second mutex's waiters after they have queued, so the priority
+// handed over with the second mutex must reflect the boost.
+static void
+tests_mutex_pi_chain(void)
+{
+	atomic_store_relaxed(&mutex_test_pi_done, false);
+	atomic_store_relaxed(&mutex_test_pi_inverted, false);
+
+	thread_t *owner = mutex_test_create_thread(
+		MUTEX_TEST_PI_LOW, MUTEX_TEST_OP_PI_OWNER, 0U);
+	mutex_test_wait_blocked(owner, SCHEDULER_BLOCK_TEST);
+
+	thread_t *first = mutex_test_create_thread(
+		MUTEX_TEST_PI_LOW, MUTEX_TEST_OP_PI_WAIT, 0U);
+	mutex_test_wait_blocked(first, SCHEDULER_BLOCK_MUTEX);
+
+	thread_t *chain = mutex_test_create_thread(
+		MUTEX_TEST_PI_LOW, MUTEX_TEST_OP_PI_CHAIN, 0U);
+	mutex_test_wait_blocked(chain, SCHEDULER_BLOCK_MUTEX);
+
+	thread_t *high = mutex_test_create_thread(
+		MUTEX_TEST_PI_HIGH, MUTEX_TEST_OP_PI_HIGH, 1U);
+	mutex_test_wait_blocked(high, SCHEDULER_BLOCK_MUTEX);
+
+	thread_t *medium = mutex_test_pi_release_owner(owner);
+
+	mutex_test_destroy_thread(owner);
+	mutex_test_destroy_thread(first);
+	mutex_test_destroy_thread(chain);
+	mutex_test_destroy_thread(high);
+	mutex_test_destroy_thread(medium);
+
+	if (atomic_load_relaxed(&mutex_test_pi_inverted)) {
+		panic("mutex test: boost lost on mutex handover");
+	}
+}
+
+bool
+tests_mutex(void)
+{
+	preempt_enable();
+
+	tests_mutex_contended();
+
+	if (cpulocal_get_index() == 0U) {
+		tests_mutex_fifo();
+		tests_mutex_pi_basic();
+		tests_mutex_pi_chain();
+	}
+
+	preempt_disable();
+
+	return false;
+}
+
+static void
+mutex_test_thread_entry(uintptr_t param)
+{
+	mutex_test_param_t test_param = mutex_test_param_cast((uint32_t)param);
+	index_t		   index      = mutex_test_param_get_index(&test_param);
+
+	switch (mutex_test_param_get_op(&test_param)) {
+	case MUTEX_TEST_OP_QUEUE:
+		mutex_acquire(&mutex_test_lock);
+		mutex_test_order[mutex_test_order_count] = index;
+		mutex_test_order_count++;
+		mutex_release(&mutex_test_lock);
+		break;
+	case MUTEX_TEST_OP_PI_OWNER: {
+		thread_t *self = thread_get_self();
+
+		mutex_acquire(&mutex_test_pi_lock[index]);
+		scheduler_lock(self);
+		scheduler_block(self, SCHEDULER_BLOCK_TEST);
+		scheduler_unlock(self);
+
+		// This returns once the test unblocks us.
+		scheduler_yield();
+		mutex_release(&mutex_test_pi_lock[index]);
+		break;
+	}
+	case MUTEX_TEST_OP_PI_WAIT:
+		mutex_acquire(&mutex_test_pi_lock[index]);
+		mutex_release(&mutex_test_pi_lock[index]);
+		break;
+	case MUTEX_TEST_OP_PI_CHAIN:
+		mutex_acquire(&mutex_test_pi_lock[1]);
+		mutex_acquire(&mutex_test_pi_lock[0]);
+		mutex_release(&mutex_test_pi_lock[0]);
+		mutex_release(&mutex_test_pi_lock[1]);
+		break;
+	case MUTEX_TEST_OP_PI_HIGH:
+		mutex_acquire(&mutex_test_pi_lock[index]);
+		atomic_store_relaxed(&mutex_test_pi_done, true);
+		mutex_release(&mutex_test_pi_lock[index]);
+		break;
+	case MUTEX_TEST_OP_PI_MEDIUM: {
+		ticks_t timeout =
+			timer_convert_ns_to_ticks(MUTEX_TEST_PI_TIMEOUT_NS);
+
+		ticks_t start = timer_get_current_timer_ticks();
+
+		while (!atomic_load_relaxed(&mutex_test_pi_done)) {
+			if ((timer_get_current_timer_ticks() - start) >
+			    timeout) {
+				atomic_store_relaxed(&mutex_test_pi_inverted,
+						     true);
+				break;
+			}
+		}
+		break;
+	}
+	default:
+		panic("Invalid param for mutex test thread!");
+	}
+}
+
+thread_func_t
+mutex_test_get_entry_fn(thread_kind_t kind)
+{
+	assert(kind == THREAD_KIND_MUTEX_TEST);
+
+	return mutex_test_thread_entry;
+}
+
+uintptr_t
+mutex_test_get_stack_base(thread_kind_t kind, thread_t *thread)
+{
+	assert(kind == THREAD_KIND_MUTEX_TEST);
+	assert(thread != NULL);
+
+	uintptr_t stack_base = atomic_fetch_add_explicit(
+		&mutex_test_stack_alloc, THREAD_STACK_MAP_ALIGN,
+		memory_order_relaxed);
+
+	assert((stack_base + (THREAD_STACK_MAP_ALIGN - 1U)) <=
+	       mutex_test_stack_end);
+
+	return stack_base;
+}
+#else
+
+extern char unused;
+
+#endif
@@ -8,16 +8,23 @@
 #include <atomic.h>
 #include <bitmap.h>
 #include <cpulocal.h>
+#include <log.h>
 #include <panic.h>
 #include <partition.h>
 #include <partition_alloc.h>
+#if defined(MODULE_CORE_RWLOCK_PHASE_FAIR)
+#include <rwlock.h>
+#endif
 #include <spinlock.h>
+#include <timer_queue.h>
+#include <trace.h>
 
 #include <asm/event.h>
 
 #include "event_handlers.h"
 
-#define TEST_ITERATIONS 100
+#define TEST_ITERATIONS		   100
+#define RWLOCK_TEST_WRITE_INTERVAL 10U
 
 extern test_info_t test_info;
 test_info_t	   test_info;
@@ -26,6 +33,33 @@ test_info_t	   test_spinlock_multi_info;
 extern test_info_t test_spinlock_multi_lock[PLATFORM_MAX_CORES];
 test_info_t	   test_spinlock_multi_lock[PLATFORM_MAX_CORES];
 
+#if defined(MODULE_CORE_RWLOCK_PHASE_FAIR)
+extern test_rwlock_info_t test_rwlock_info;
+test_rwlock_info_t	  test_rwlock_info;
+
+static _Atomic count_t test_rwlock_ready;
+#endif
+
+#if defined(SPINLOCK_BENCHMARK)
+#define SPINLOCK_BENCH_ITERATIONS     10000U
+#define SPINLOCK_BENCH_WRITE_INTERVAL 64U
+#define SPINLOCK_BENCH_SHARED	      0U
+#define SPINLOCK_BENCH_LOCAL	      1U
+#define SPINLOCK_BENCH_READ_SPINLOCK  2U
+#define SPINLOCK_BENCH_READ_RWLOCK    3U
+#define SPINLOCK_BENCH_NUM	      4U
+
+static test_info_t	  bench_shared;
+static test_info_t	  bench_local[PLATFORM_MAX_CORES];
+static test_info_t	  bench_read;
+#if defined(MODULE_CORE_RWLOCK_PHASE_FAIR)
+static test_rwlock_info_t bench_rwlock;
+#endif
+static _Atomic count_t bench_ready[SPINLOCK_BENCH_NUM];
+static _Atomic count_t bench_done[SPINLOCK_BENCH_NUM];
+static _Atomic ticks_t bench_ticks[SPINLOCK_BENCH_NUM];
+#endif
+
 #if defined(UNIT_TESTS)
 void
 tests_spinlock_single_lock_init(void)
@@ -168,3 +202,211 @@ tests_spinlock_multiple_locks(void)
 
 	return ret;
 }
+
+#if defined(MODULE_CORE_RWLOCK_PHASE_FAIR)
+#if defined(UNIT_TESTS)
+void
+tests_rwlock_init(void)
+{
+	rwlock_init(&test_rwlock_info.lock);
+	test_rwlock_info.count_a = 0;
+	test_rwlock_info.count_b = 0;
+}
+#endif
+
+// Every core mostly reads the two counts, checking that they are equal, and
+// occasionally increments both of them.
+bool
+tests_rwlock(void)
+{
+	bool ret     = false;
+	bool waiting = true;
+
+	// Wait until all cores have reached this point to start.
+	(void)atomic_fetch_add_explicit(&test_rwlock_ready, 1U,
+					memory_order_relaxed);
+	asm_event_wake_updated();
+	while (asm_event_load_before_wait(&test_rwlock_ready) !=
+	       PLATFORM_MAX_CORES) {
+		asm_event_wait(&test_rwlock_ready);
+	}
+
+	for (count_t i = 0; i < TEST_ITERATIONS; i++) {
+		if ((i % RWLOCK_TEST_WRITE_INTERVAL) == 0U) {
+			rwlock_write_acquire_nopreempt(&test_rwlock_info.lock);
+			test_rwlock_info.count_a++;
+			test_rwlock_info.count_b++;
+			rwlock_write_release_nopreempt(&test_rwlock_info.lock);
+		} else {
+			rwlock_read_acquire_nopreempt(&test_rwlock_info.lock);
+			if (test_rwlock_info.count_a !=
+			    test_rwlock_info.count_b) {
+				panic("rwlock test: torn read");
+			}
+			rwlock_read_release_nopreempt(&test_rwlock_info.lock);
+		}
+	}
+
+	// If test succeeds, each count should be
+	// (TEST_ITERATIONS / RWLOCK_TEST_WRITE_INTERVAL) * PLATFORM_MAX_CORES
+	while (waiting) {
+		rwlock_read_acquire_nopreempt(&test_rwlock_info.lock);
+
+		if (test_rwlock_info.count_a ==
+		    ((TEST_ITERATIONS / RWLOCK_TEST_WRITE_INTERVAL) *
+		     PLATFORM_MAX_CORES)) {
+			waiting = false;
+		}
+
+		rwlock_read_release_nopreempt(&test_rwlock_info.lock);
+	}
+
+	return ret;
+}
+#endif
+
+#if defined(SPINLOCK_BENCHMARK)
+void
+tests_spinlock_benchmark_init(void)
+{
+	spinlock_init(&bench_shared.lock);
+	bench_shared.count = 0;
+
+	for (cpu_index_t i = 0U; cpulocal_index_valid(i); i++) {
+		spinlock_init(&bench_local[i].lock);
+		bench_local[i].count = 0;
+	}
+
+	spinlock_init(&bench_read.lock);
+	bench_read.count = 0;
+#if defined(MODULE_CORE_RWLOCK_PHASE_FAIR)
+	rwlock_init(&bench_rwlock.lock);
+	bench_rwlock.count_a = 0;
+	bench_rwlock.count_b = 0;
+#endif
+}
+
+static ticks_t
+bench_start(index_t phase) REQUIRE_PREEMPT_DISABLED
+{
+	// Start all cores together, so a shared lock is contended throughout.
+	(void)atomic_fetch_add_explicit(&bench_ready[phase], 1U,
+					memory_order_relaxed);
+	asm_event_wake_updated();
+	while (asm_event_load_before_wait(&bench_ready[phase]) !=
+	       PLATFORM_MAX_CORES) {
+		asm_event_wait(&bench_ready[phase]);
+	}
+
+	return timer_get_current_timer_ticks();
+}
+
+static void
+bench_finish(const char *name, index_t phase, ticks_t start)
+	REQUIRE_PREEMPT_DISABLED
+{
+	ticks_t elapsed = timer_get_current_timer_ticks() - start;
+
+	(void)atomic_fetch_add_explicit(&bench_ticks[phase], elapsed,
+					memory_order_relaxed);
+	(void)atomic_fetch_add_explicit(&bench_done[phase], 1U,
+					memory_order_release);
+	asm_event_wake_updated();
+
+	if (cpulocal_get_index() == 0U) {
+		while (asm_event_load_before_wait(&bench_done[phase]) !=
+		       PLATFORM_MAX_CORES) {
+			asm_event_wait(&bench_done[phase]);
+		}
+
+		nanoseconds_t ns = timer_convert_ticks_to_ns(
+			atomic_load_relaxed(&bench_ticks[phase]));
+		LOG(DEBUG, INFO,
+		    "spinlock bench {:s}: {:d} ns per acquire and release",
+		    (register_t)name,
+		    ns / ((nanoseconds_t)PLATFORM_MAX_CORES *
+			  SPINLOCK_BENCH_ITERATIONS));
+	}
+}
+
+static void
+bench_spinlock(const char *name, test_info_t *info, index_t phase)
+	REQUIRE_PREEMPT_DISABLED
+{
+	ticks_t start = bench_start(phase);
+
+	for (count_t i = 0U; i < SPINLOCK_BENCH_ITERATIONS; i++) {
+		spinlock_acquire_nopreempt(&info->lock);
+		info->count++;
+		spinlock_release_nopreempt(&info->lock);
+	}
+
+	bench_finish(name, phase, start);
+}
+
+static void
+bench_read_mostly_spinlock(void) REQUIRE_PREEMPT_DISABLED
+{
+	ticks_t start = bench_start(SPINLOCK_BENCH_READ_SPINLOCK);
+
+	for (count_t i = 0U; i < SPINLOCK_BENCH_ITERATIONS; i++) {
+		spinlock_acquire_nopreempt(&bench_read.lock);
+		if ((i % SPINLOCK_BENCH_WRITE_INTERVAL) == 0U) {
+			bench_read.count++;
+		} else {
+			assert(bench_read.count != 0U);
+		}
+		spinlock_release_nopreempt(&bench_read.lock);
+	}
+
+	bench_finish("read-mostly spinlock", SPINLOCK_BENCH_READ_SPINLOCK,
+		     start);
+}
+
+#if defined(MODULE_CORE_RWLOCK_PHASE_FAIR)
+static void
+bench_read_mostly_rwlock(void) REQUIRE_PREEMPT_DISABLED
+{
+	ticks_t start = bench_start(SPINLOCK_BENCH_READ_RWLOCK);
+
+	for (count_t i = 0U; i < SPINLOCK_BENCH_ITERATIONS; i++) {
+		if ((i % SPINLOCK_BENCH_WRITE_INTERVAL) == 0U) {
+			rwlock_write_acquire_nopreempt(&bench_rwlock.lock);
+			bench_rwlock.count_a++;
+			bench_rwlock.count_b++;
+			rwlock_write_release_nopreempt(&bench_rwlock.lock);
+		} else {
+			rwlock_read_acquire_nopreempt(&bench_rwlock.lock);
+			assert(bench_rwlock.count_a == bench_rwlock.count_b);
+			rwlock_read_release_nopreempt(&bench_rwlock.lock);
+		}
+	}
+
+	bench_finish("read-mostly rwlock", SPINLOCK_BENCH_READ_RWLOCK, start);
+}
+#endif
+
+// Measure the cost of acquiring and releasing a spinlock, both when every core
+// is contending for the same lock, and when each core has its own lock. Build
+// with each spinlock module to compare them. Then compare a spinlock and a
+// reader-writer lock protecting read-mostly data, if one is configured.
+bool
+tests_spinlock_benchmark(void)
+{
+	cpu_index_t cpu = cpulocal_get_index();
+
+	bench_spinlock("contended", &bench_shared, SPINLOCK_BENCH_SHARED);
+	bench_spinlock("uncontended", &bench_local[cpu], SPINLOCK_BENCH_LOCAL);
+	bench_read_mostly_spinlock();
+#if defined(MODULE_CORE_RWLOCK_PHASE_FAIR)
+	bench_read_mostly_rwlock();
+#endif
+
+	if (cpu == 0U) {
+		assert(bench_shared.count ==
+		       (PLATFORM_MAX_CORES * SPINLOCK_BENCH_ITERATIONS));
+	}
+
+	return false;
+}
+#endif
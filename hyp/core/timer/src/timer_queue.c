@@ -5,20 +5,23 @@
 #include <assert.h>
 #include <hyptypes.h>
 
+#include <hypcall_def.h>
 #include <hypcontainers.h>
 
 #include <atomic.h>
 #include <compiler.h>
 #include <cpulocal.h>
+#include <heap.h>
 #include <ipi.h>
-#include <list.h>
 #include <object.h>
 #include <panic.h>
 #include <partition.h>
 #include <platform_cpu.h>
 #include <platform_timer.h>
 #include <preempt.h>
+#include <scheduler.h>
 #include <spinlock.h>
+#include <thread.h>
 #include <timer_queue.h>
 #include <util.h>
 
@@ -38,9 +41,12 @@ timer_handle_boot_cold_init(cpu_index_t boot_cpu_index)
 	     cpu_index++) {
 		timer_queue_t *tq = &CPULOCAL_BY_INDEX(timer_queue, cpu_index);
 		spinlock_init(&tq->lock);
-		list_init(&tq->list);
-		tq->timeout = TIMER_INVALID_TIMEOUT;
-		tq->online  = (cpu_index == boot_cpu_index);
+		heap_init(&tq->heap);
+		heap_init(&tq->deadline_heap);
+		tq->timeout	= TIMER_INVALID_TIMEOUT;
+		tq->deadline	= TIMER_INVALID_TIMEOUT;
+		tq->hw_deadline = TIMER_INVALID_TIMEOUT;
+		tq->online	= (cpu_index == boot_cpu_index);
 	}
 }
 
@@ -77,24 +83,120 @@ timer_convert_ticks_to_ns(ticks_t ticks)
 }
 
 static bool
-is_timeout_a_smaller_than_b(list_node_t *node_a, list_node_t *node_b)
+is_timeout_a_smaller_than_b(heap_node_t *node_a, heap_node_t *node_b)
 {
-	ticks_t timeout_a = timer_container_of_list_node(node_a)->timeout;
-	ticks_t timeout_b = timer_container_of_list_node(node_b)->timeout;
+	ticks_t timeout_a = timer_container_of_heap_node(node_a)->timeout;
+	ticks_t timeout_b = timer_container_of_heap_node(node_b)->timeout;
 
 	return timeout_a < timeout_b;
 }
 
+static ticks_t
+timer_get_deadline(const timer_t *timer)
+{
+	// Saturate rather than wrapping, so a very late timeout never gets an
+	// early deadline.
+	return (timer->slack > (TIMER_INVALID_TIMEOUT - timer->timeout))
+		       ? TIMER_INVALID_TIMEOUT
+		       : (timer->timeout + timer->slack);
+}
+
+static bool
+is_deadline_a_smaller_than_b(heap_node_t *node_a, heap_node_t *node_b)
+{
+	ticks_t deadline_a =
+		timer_get_deadline(timer_container_of_deadline_node(node_a));
+	ticks_t deadline_b =
+		timer_get_deadline(timer_container_of_deadline_node(node_b));
+
+	return deadline_a < deadline_b;
+}
+
+static timer_t *
+timer_queue_get_head(timer_queue_t *tq) REQUIRE_SPINLOCK(tq->lock)
+{
+	heap_node_t *head = heap_get_min(&tq->heap);
+
+	return (head != NULL) ? timer_container_of_heap_node(head) : NULL;
+}
+
+// Set the queue's timeout and deadline from its head timers, after either of
+// the heads has changed.
+static void
+timer_queue_set_timeout(timer_queue_t *tq) REQUIRE_SPINLOCK(tq->lock)
+{
+	timer_t	    *head = timer_queue_get_head(tq);
+	heap_node_t *node = heap_get_min(&tq->deadline_heap);
+
+	tq->timeout  = TIMER_INVALID_TIMEOUT;
+	tq->deadline = TIMER_INVALID_TIMEOUT;
+
+	if (head != NULL) {
+		assert(node != NULL);
+		tq->timeout  = head->timeout;
+		tq->deadline = timer_get_deadline(
+			timer_container_of_deadline_node(node));
+	}
+}
+
+// Add a timer to the queue's heaps. Returns true if the queue's timeout or
+// deadline may have changed, in which case they have been updated.
+static bool
+timer_queue_insert(timer_queue_t *tq, timer_t *timer)
+	REQUIRE_SPINLOCK(tq->lock)
+{
+	bool new_head = heap_insert(&tq->heap, &timer->heap_node,
+				    is_timeout_a_smaller_than_b);
+	bool new_deadline_head =
+		heap_insert(&tq->deadline_heap, &timer->deadline_node,
+			    is_deadline_a_smaller_than_b);
+
+	if (new_head || new_deadline_head) {
+		timer_queue_set_timeout(tq);
+	}
+
+	return new_head || new_deadline_head;
+}
+
+// Remove a timer from the queue's heaps. Returns true if the queue's timeout
+// or deadline may have changed, in which case they have been updated.
+static bool
+timer_queue_remove(timer_queue_t *tq, timer_t *timer)
+	REQUIRE_SPINLOCK(tq->lock)
+{
+	bool new_head = heap_delete_node(&tq->heap, &timer->heap_node,
+					 is_timeout_a_smaller_than_b);
+	bool new_deadline_head =
+		heap_delete_node(&tq->deadline_heap, &timer->deadline_node,
+				 is_deadline_a_smaller_than_b);
+
+	if (new_head || new_deadline_head) {
+		timer_queue_set_timeout(tq);
+	}
+
+	return new_head || new_deadline_head;
+}
+
 void
 timer_init_object(timer_t *timer, timer_action_t action)
 {
 	assert(timer != NULL);
 
 	timer->timeout = TIMER_INVALID_TIMEOUT;
+	timer->slack   = 0U;
 	timer->action  = action;
 	atomic_init(&timer->queue, NULL);
 }
 
+void
+timer_set_slack(timer_t *timer, ticks_t slack)
+{
+	assert(timer != NULL);
+	assert(!timer_is_queued(timer));
+
+	timer->slack = slack;
+}
+
 bool
 timer_is_queued(timer_t *timer)
 {
@@ -110,25 +212,98 @@ timer_queue_get_next_timeout(void)
 	ticks_t	       timeout;
 
 	spinlock_acquire_nopreempt(&tq->lock);
-	timeout = tq->timeout;
+	timeout = tq->deadline;
 	spinlock_release_nopreempt(&tq->lock);
 
 	return timeout;
 }
 
 static void
-timer_update_timeout(timer_queue_t *tq) REQUIRE_SPINLOCK(tq->lock)
+timer_flush_timeout(timer_queue_t *tq) REQUIRE_SPINLOCK(tq->lock)
 {
 	assert_preempt_disabled();
 	assert(tq == &CPULOCAL(timer_queue));
 
-	if (tq->timeout != TIMER_INVALID_TIMEOUT) {
-		platform_timer_set_timeout(tq->timeout);
+	if (!tq->hw_dirty) {
+		// Nothing to do.
+	} else if (tq->deadline == tq->hw_deadline) {
+		tq->hw_dirty = false;
+		tq->stats.hw_updates_avoided++;
 	} else {
-		platform_timer_cancel_timeout();
+		tq->hw_dirty = false;
+		tq->stats.hw_updates++;
+
+		if (tq->deadline != TIMER_INVALID_TIMEOUT) {
+			platform_timer_set_timeout(tq->deadline);
+		} else {
+			platform_timer_cancel_timeout();
+		}
+		tq->hw_deadline = tq->deadline;
+	}
+}
+
+// Note that the platform timer needs to be reprogrammed after the queue's
+// deadline has changed.
+//
+// If the deadline is now later than the platform timer, the write is deferred
+// until timer_flush_timeout() is called, so that several queue changes during
+// one entry to the hypervisor cost at most one write. In the meantime the
+// platform timer may fire early, which is harmless. If the deadline is now
+// earlier, the write can't be deferred, or the timer might fire late.
+static void
+timer_update_timeout(timer_queue_t *tq) REQUIRE_SPINLOCK(tq->lock)
+{
+	assert_preempt_disabled();
+	assert(tq == &CPULOCAL(timer_queue));
+
+	if (tq->hw_dirty) {
+		// The pending write is superseded by this one.
+		tq->stats.hw_updates_avoided++;
+	}
+	tq->hw_dirty = true;
+
+	if (tq->deadline < tq->hw_deadline) {
+		timer_flush_timeout(tq);
 	}
 }
 
+// Reprogram the platform timer if the local queue has changed since it was
+// last programmed. This is called before leaving the hypervisor, and before
+// switching threads or waiting for interrupts, to avoid spurious interrupts.
+static void
+timer_flush_local(void) REQUIRE_PREEMPT_DISABLED
+{
+	timer_queue_t *tq = &CPULOCAL(timer_queue);
+
+	// The dirty flag is only set by this CPU, so it is safe to check
+	// without the lock.
+	if (compiler_unexpected(tq->hw_dirty)) {
+		spinlock_acquire_nopreempt(&tq->lock);
+		timer_flush_timeout(tq);
+		spinlock_release_nopreempt(&tq->lock);
+	}
+}
+
+void
+timer_handle_thread_exit_to_user(void)
+{
+	timer_flush_local();
+}
+
+void
+timer_handle_thread_context_switch_post(void)
+{
+	timer_flush_local();
+}
+
+idle_state_t
+timer_handle_idle_yield(void)
+{
+	timer_flush_local();
+
+	return IDLE_STATE_IDLE;
+}
+
 static void
 timer_enqueue_internal(timer_queue_t *tq, timer_t *timer, ticks_t timeout)
 	REQUIRE_SPINLOCK(tq->lock)
@@ -153,10 +328,7 @@ timer_enqueue_internal(timer_queue_t *tq, timer_t *timer, ticks_t timeout)
 	// condition is already met.
 	timer->timeout = timeout;
 
-	bool new_head = list_insert_in_order(&tq->list, &timer->list_node,
-					     is_timeout_a_smaller_than_b);
-	if (new_head) {
-		tq->timeout = timeout;
+	if (timer_queue_insert(tq, timer)) {
 		timer_update_timeout(tq);
 	}
 }
@@ -173,18 +345,7 @@ timer_dequeue_internal(timer_queue_t *tq, timer_t *timer)
 	// acquiring its lock. Ensure the timer's queue has not changed before
 	// dequeuing.
 	if (compiler_expected(atomic_load_relaxed(&timer->queue) == tq)) {
-		bool new_head = list_delete_node(&tq->list, &timer->list_node);
-		if (new_head) {
-			list_node_t *head = list_get_head(&tq->list);
-			tq->timeout =
-				timer_container_of_list_node(head)->timeout;
-			new_timeout = true;
-		} else if (list_is_empty(&tq->list)) {
-			tq->timeout = TIMER_INVALID_TIMEOUT;
-			new_timeout = true;
-		} else {
-			// The queue's timeout has not changed.
-		}
+		new_timeout = timer_queue_remove(tq, timer);
 
 		// Clear the timer's queue pointer. We need release ordering to
 		// ensure this dequeue is observed by the next enqueue.
@@ -215,24 +376,120 @@ timer_update_internal(timer_queue_t *tq, timer_t *timer, ticks_t timeout)
 
 		// Delete timer from queue, update it, and add it again to queue
 
-		bool new_head_delete =
-			list_delete_node(&tq->list, &timer->list_node);
+		bool new_head_delete = timer_queue_remove(tq, timer);
 
 		timer->timeout = timeout;
 
-		bool new_head_insert =
-			list_insert_in_order(&tq->list, &timer->list_node,
-					     is_timeout_a_smaller_than_b);
+		bool new_head_insert = timer_queue_insert(tq, timer);
 
 		if (new_head_delete || new_head_insert) {
-			list_node_t *head = list_get_head(&tq->list);
-			tq->timeout =
-				timer_container_of_list_node(head)->timeout;
 			timer_update_timeout(tq);
 		}
 	}
 }
 
+static bool
+timer_try_move_to_cpu(timer_t *timer, cpu_index_t target)
+	REQUIRE_PREEMPT_DISABLED
+{
+	bool	       moved = false;
+	timer_queue_t *ttq   = &CPULOCAL_BY_INDEX(timer_queue, target);
+
+	assert_preempt_disabled();
+
+	spinlock_acquire_nopreempt(&ttq->lock);
+
+	// We can only use active CPU timer queues
+	if (ttq->online) {
+		// Update the timer queue to be on the new CPU
+		timer_queue_t *old_ttq = NULL;
+		if (!atomic_compare_exchange_strong_explicit(
+			    &timer->queue, &old_ttq, ttq, memory_order_acquire,
+			    memory_order_relaxed)) {
+			panic("Request to move timer that is already queued");
+		}
+
+		// Call IPI if the queue HEAD changed so the target CPU can
+		// update its local timer
+		if (timer_queue_insert(ttq, timer)) {
+			spinlock_release_nopreempt(&ttq->lock);
+			ipi_one(IPI_REASON_TIMER_QUEUE_SYNC, target);
+		} else {
+			spinlock_release_nopreempt(&ttq->lock);
+		}
+		moved = true;
+	} else {
+		spinlock_release_nopreempt(&ttq->lock);
+	}
+
+	return moved;
+}
+
+// Timers queued on an isolated CPU are moved to a housekeeping CPU, unless
+// their action must run locally.
+static bool
+timer_should_offload(const timer_t *timer) REQUIRE_PREEMPT_DISABLED
+{
+	return compiler_unexpected(
+		       scheduler_is_cpu_isolated(cpulocal_get_index())) &&
+	       !trigger_timer_action_is_cpu_local_event(timer->action);
+}
+
+static bool
+timer_try_offload(timer_t *timer, ticks_t timeout) REQUIRE_PREEMPT_DISABLED
+{
+	bool	    offloaded = false;
+	cpu_index_t target =
+		scheduler_get_housekeeping_cpu(cpulocal_get_index());
+
+	if (cpulocal_index_valid(target)) {
+		timer->timeout = timeout;
+		offloaded      = timer_try_move_to_cpu(timer, target);
+	}
+
+	return offloaded;
+}
+
+static timer_t *
+timer_find_offloadable(timer_queue_t *tq) REQUIRE_SPINLOCK(tq->lock)
+{
+	timer_t	    *timer = NULL;
+	heap_node_t *node  = heap_get_min(&tq->heap);
+
+	while (node != NULL) {
+		timer_t *iter = timer_container_of_heap_node(node);
+		if (!trigger_timer_action_is_cpu_local_event(iter->action)) {
+			timer = iter;
+			break;
+		}
+		node = heap_get_next(node);
+	}
+
+	return timer;
+}
+
+// Dequeue a timer that was last seen on the given queue. The timer may be
+// moved to another CPU's queue while we are waiting for the lock (see
+// timer_handle_scheduler_cpu_isolation_changed()); if so, follow it there.
+static void
+timer_dequeue_from(timer_queue_t *tq, timer_t *timer) REQUIRE_PREEMPT_DISABLED
+{
+	while (tq != NULL) {
+		spinlock_acquire_nopreempt(&tq->lock);
+		timer_queue_t *cur_tq = atomic_load_relaxed(&timer->queue);
+		if (cur_tq == tq) {
+			if (timer_dequeue_internal(tq, timer) &&
+			    (tq == &CPULOCAL(timer_queue))) {
+				timer_update_timeout(tq);
+			}
+			cur_tq = NULL;
+		}
+		spinlock_release_nopreempt(&tq->lock);
+
+		tq = cur_tq;
+	}
+}
+
 void
 timer_enqueue(timer_t *timer, ticks_t timeout)
 {
@@ -240,11 +497,14 @@ timer_enqueue(timer_t *timer, ticks_t timeout)
 
 	preempt_disable();
 
-	timer_queue_t *tq = &CPULOCAL(timer_queue);
+	if (!timer_should_offload(timer) ||
+	    !timer_try_offload(timer, timeout)) {
+		timer_queue_t *tq = &CPULOCAL(timer_queue);
 
-	spinlock_acquire_nopreempt(&tq->lock);
-	timer_enqueue_internal(tq, timer, timeout);
-	spinlock_release_nopreempt(&tq->lock);
+		spinlock_acquire_nopreempt(&tq->lock);
+		timer_enqueue_internal(tq, timer, timeout);
+		spinlock_release_nopreempt(&tq->lock);
+	}
 
 	preempt_enable();
 }
@@ -254,16 +514,9 @@ timer_dequeue(timer_t *timer)
 {
 	assert(timer != NULL);
 
-	timer_queue_t *tq = atomic_load_relaxed(&timer->queue);
-
-	if (tq != NULL) {
-		spinlock_acquire(&tq->lock);
-		if (timer_dequeue_internal(tq, timer) &&
-		    (tq == &CPULOCAL(timer_queue))) {
-			timer_update_timeout(tq);
-		}
-		spinlock_release(&tq->lock);
-	}
+	preempt_disable();
+	timer_dequeue_from(atomic_load_relaxed(&timer->queue), timer);
+	preempt_enable();
 }
 
 void
@@ -276,11 +529,21 @@ timer_update(timer_t *timer, ticks_t timeout)
 	timer_queue_t *old_tq = atomic_load_relaxed(&timer->queue);
 	timer_queue_t *new_tq = &CPULOCAL(timer_queue);
 
-	// If timer is queued on another CPU, it needs to be dequeued.
+	if (timer_should_offload(timer)) {
+		// Requeue the timer on a housekeeping CPU.
+		timer_dequeue_from(old_tq, timer);
+		old_tq = NULL;
+
+		if (timer_try_offload(timer, timeout)) {
+			goto out;
+		}
+	}
+
+	// If timer is queued on another CPU, it needs to be dequeued. The
+	// timer can't be moved to or from this CPU's queue concurrently,
+	// because that is only done by this CPU.
 	if ((old_tq != NULL) && (old_tq != new_tq)) {
-		spinlock_acquire_nopreempt(&old_tq->lock);
-		(void)timer_dequeue_internal(old_tq, timer);
-		spinlock_release_nopreempt(&old_tq->lock);
+		timer_dequeue_from(old_tq, timer);
 	}
 
 	spinlock_acquire_nopreempt(&new_tq->lock);
@@ -291,6 +554,7 @@ timer_update(timer_t *timer, ticks_t timeout)
 	}
 	spinlock_release_nopreempt(&new_tq->lock);
 
+out:
 	preempt_enable();
 }
 
@@ -304,16 +568,32 @@ timer_dequeue_expired(void) REQUIRE_PREEMPT_DISABLED
 
 	spinlock_acquire_nopreempt(&tq->lock);
 
+	// If the earliest timer's slack delayed this expiry, timers with later
+	// timeouts than the earliest one would have needed their own
+	// interrupts; count them as coalesced. Timers that expire together
+	// without any slack are not counted.
+	ticks_t first_timeout = tq->timeout;
+	bool	slack_delayed = tq->deadline > first_timeout;
+	if (first_timeout <= current_ticks) {
+		tq->stats.expiries++;
+	}
+
 	while (tq->timeout <= current_ticks) {
-		list_node_t *head  = list_get_head(&tq->list);
-		timer_t	    *timer = timer_container_of_list_node(head);
+		timer_t *timer = timer_queue_get_head(tq);
+		tq->stats.fired++;
+		if (slack_delayed && (timer->timeout > first_timeout)) {
+			tq->stats.coalesced++;
+		}
 		(void)timer_dequeue_internal(tq, timer);
 		spinlock_release_nopreempt(&tq->lock);
 		(void)trigger_timer_action_event(timer->action, timer);
 		spinlock_acquire_nopreempt(&tq->lock);
 	}
 
+	// Reprogram the platform timer now; if its deadline has passed and is
+	// not updated, the interrupt will be asserted again.
 	timer_update_timeout(tq);
+	timer_flush_timeout(tq);
 	spinlock_release_nopreempt(&tq->lock);
 }
 
@@ -333,8 +613,14 @@ timer_handle_power_cpu_suspend(void)
 	// The timer_lp module will enqueue the timeout on the global low power
 	// timer, so we can cancel the core-local timer to avoid redundant
 	// interrupts if the suspend finishes without entering a state that
-	// stops the timer.
+	// stops the timer. It will be reprogrammed on resume.
+	timer_queue_t *tq = &CPULOCAL(timer_queue);
+	spinlock_acquire_nopreempt(&tq->lock);
 	platform_timer_cancel_timeout();
+	tq->hw_deadline = TIMER_INVALID_TIMEOUT;
+	spinlock_release_nopreempt(&tq->lock);
+#else
+	timer_flush_local();
 #endif
 
 	return OK;
@@ -365,47 +651,6 @@ timer_handle_ipi_received(void)
 	return true;
 }
 
-static bool
-timer_try_move_to_cpu(timer_t *timer, cpu_index_t target)
-	REQUIRE_PREEMPT_DISABLED
-{
-	bool	       moved = false;
-	timer_queue_t *ttq   = &CPULOCAL_BY_INDEX(timer_queue, target);
-
-	assert_preempt_disabled();
-
-	spinlock_acquire_nopreempt(&ttq->lock);
-
-	// We can only use active CPU timer queues
-	if (ttq->online) {
-		// Update the timer queue to be on the new CPU
-		timer_queue_t *old_ttq = NULL;
-		if (!atomic_compare_exchange_strong_explicit(
-			    &timer->queue, &old_ttq, ttq, memory_order_acquire,
-			    memory_order_relaxed)) {
-			panic("Request to move timer that is already queued");
-		}
-
-		// Call IPI if the queue HEAD changed so the target CPU can
-		// update its local timer
-		bool new_head =
-			list_insert_in_order(&ttq->list, &timer->list_node,
-					     is_timeout_a_smaller_than_b);
-		if (new_head) {
-			ttq->timeout = timer->timeout;
-			spinlock_release_nopreempt(&ttq->lock);
-			ipi_one(IPI_REASON_TIMER_QUEUE_SYNC, target);
-		} else {
-			spinlock_release_nopreempt(&ttq->lock);
-		}
-		moved = true;
-	} else {
-		spinlock_release_nopreempt(&ttq->lock);
-	}
-
-	return moved;
-}
-
 void
 timer_handle_power_cpu_offline(void)
 {
@@ -422,11 +667,12 @@ timer_handle_power_cpu_offline(void)
 	// Mark this CPU timer queue as going down and cancel any pending timers
 	tq->online = false;
 	platform_timer_cancel_timeout();
+	tq->hw_deadline = TIMER_INVALID_TIMEOUT;
+	tq->hw_dirty	= false;
 
 	// Move all active timers in this CPU timer queue to an active CPU
 	while (tq->timeout != TIMER_INVALID_TIMEOUT) {
-		list_node_t *head  = list_get_head(&tq->list);
-		timer_t	    *timer = timer_container_of_list_node(head);
+		timer_t *timer = timer_queue_get_head(tq);
 
 		// Remove timer from this core.
 		(void)timer_dequeue_internal(tq, timer);
@@ -474,3 +720,112 @@ timer_handle_power_cpu_offline(void)
 
 	spinlock_release_nopreempt(&tq->lock);
 }
+
+void
+timer_handle_scheduler_cpu_isolation_changed(bool isolated)
+{
+	assert_preempt_disabled();
+
+	// Timers already offloaded stay where they are when isolation ends.
+	cpu_index_t this_cpu = cpulocal_get_index();
+	cpu_index_t target   = CPU_INDEX_INVALID;
+	if (isolated) {
+		target = scheduler_get_housekeeping_cpu(this_cpu);
+	}
+	if (!cpulocal_index_valid(target)) {
+		goto out;
+	}
+	assert(target != this_cpu);
+
+	timer_queue_t *tq	   = &CPULOCAL(timer_queue);
+	timer_queue_t *ttq	   = &CPULOCAL_BY_INDEX(timer_queue, target);
+	bool	       ttq_changed = false;
+
+	// Hold both queue locks, taken in CPU index order, so each timer moves
+	// directly from one queue to the other. A concurrent dequeue or update
+	// on another CPU will find it on one queue or the other.
+	if (this_cpu < target) {
+		spinlock_acquire_nopreempt(&tq->lock);
+		spinlock_acquire_nopreempt(&ttq->lock);
+	} else {
+		spinlock_acquire_nopreempt(&ttq->lock);
+		spinlock_acquire_nopreempt(&tq->lock);
+	}
+
+	// If the target is going offline, keep the timers here.
+	if (ttq->online) {
+		timer_t *timer = timer_find_offloadable(tq);
+		while (timer != NULL) {
+			(void)timer_queue_remove(tq, timer);
+			atomic_store_relaxed(&timer->queue, ttq);
+			if (timer_queue_insert(ttq, timer)) {
+				ttq_changed = true;
+			}
+
+			// The heap has changed, so search again from the head.
+			timer = timer_find_offloadable(tq);
+		}
+	}
+
+	timer_update_timeout(tq);
+	timer_flush_timeout(tq);
+
+	spinlock_release_nopreempt(&tq->lock);
+	spinlock_release_nopreempt(&ttq->lock);
+
+	// The target CPU needs to update its local timer if its queue's head
+	// has changed.
+	if (ttq_changed) {
+		ipi_one(IPI_REASON_TIMER_QUEUE_SYNC, target);
+	}
+
+out:
+	return;
+}
+
+hypercall_timer_get_stats_result_t
+hypercall_timer_get_stats(cpu_index_t cpu, timer_stat_t stat)
+{
+	hypercall_timer_get_stats_result_t ret = { 0 };
+
+	// Only privileged VMs (i.e. the root VM) may read the statistics.
+	if (!partition_option_flags_get_privileged(
+		    &thread_get_self()->header.partition->options)) {
+		ret.error = ERROR_DENIED;
+		goto out;
+	}
+
+	if (!cpulocal_index_valid(cpu)) {
+		ret.error = ERROR_ARGUMENT_INVALID;
+		goto out;
+	}
+
+	timer_queue_t *tq = &CPULOCAL_BY_INDEX(timer_queue, cpu);
+
+	ret.error = OK;
+	spinlock_acquire(&tq->lock);
+	switch (stat) {
+	case TIMER_STAT_EXPIRIES:
+		ret.value = tq->stats.expiries;
+		break;
+	case TIMER_STAT_FIRED:
+		ret.value = tq->stats.fired;
+		break;
+	case TIMER_STAT_COALESCED:
+		ret.value = tq->stats.coalesced;
+		break;
+	case TIMER_STAT_HW_UPDATES:
+		ret.value = tq->stats.hw_updates;
+		break;
+	case TIMER_STAT_HW_UPDATES_AVOIDED:
+		ret.value = tq->stats.hw_updates_avoided;
+		break;
+	default:
+		ret.error = ERROR_ARGUMENT_INVALID;
+		break;
+	}
+	spinlock_release(&tq->lock);
+
+out:
+	return ret;
+}
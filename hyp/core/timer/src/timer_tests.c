@@ -10,6 +10,8 @@
 #include <atomic.h>
 #include <compiler.h>
 #include <cpulocal.h>
+#include <heap.h>
+#include <list.h>
 #include <log.h>
 #include <panic.h>
 #include <preempt.h>
@@ -31,6 +33,84 @@ CPULOCAL_DECLARE_STATIC(uint8_t, test_num);
 CPULOCAL_DECLARE_STATIC(_Atomic bool, in_progress);
 CPULOCAL_DECLARE_STATIC(ticks_t, expected_timeout);
 
+#if defined(TIMER_BENCHMARK)
+static timer_bench_node_t timer_bench_nodes[TIMER_BENCH_NODES];
+
+static bool
+timer_bench_list_compare(list_node_t *node_a, list_node_t *node_b)
+{
+	return timer_bench_node_container_of_list_node(node_a)->timeout <
+	       timer_bench_node_container_of_list_node(node_b)->timeout;
+}
+
+static bool
+timer_bench_heap_compare(heap_node_t *node_a, heap_node_t *node_b)
+{
+	return timer_bench_node_container_of_heap_node(node_a)->timeout <
+	       timer_bench_node_container_of_heap_node(node_b)->timeout;
+}
+
+// Compare the cost of inserting and then cancelling a set of timers with
+// random timeouts, using the heap that backs the timer queue and using the
+// sorted list that it replaced. This runs only on CPU 0.
+bool
+tests_timer_benchmark(void)
+{
+	list_t	list;
+	heap_t	heap;
+	ticks_t start;
+	ticks_t list_ticks;
+	ticks_t heap_ticks;
+
+	if (cpulocal_get_index() != 0U) {
+		goto out;
+	}
+
+	// Simple LCG, so the timeouts are the same on every run.
+	uint32_t seed = 1U;
+	for (index_t i = 0U; i < TIMER_BENCH_NODES; i++) {
+		seed = (seed * 1103515245U) + 12345U;
+
+		timer_bench_nodes[i].timeout = (ticks_t)(seed >> 8);
+	}
+
+	list_init(&list);
+	start = timer_get_current_timer_ticks();
+	for (index_t i = 0U; i < TIMER_BENCH_NODES; i++) {
+		(void)list_insert_in_order(&list,
+					   &timer_bench_nodes[i].list_node,
+					   timer_bench_list_compare);
+	}
+	for (index_t i = 0U; i < TIMER_BENCH_NODES; i++) {
+		(void)list_delete_node(&list, &timer_bench_nodes[i].list_node);
+	}
+	list_ticks = timer_get_current_timer_ticks() - start;
+
+	heap_init(&heap);
+	start = timer_get_current_timer_ticks();
+	for (index_t i = 0U; i < TIMER_BENCH_NODES; i++) {
+		(void)heap_insert(&heap, &timer_bench_nodes[i].heap_node,
+				  timer_bench_heap_compare);
+	}
+	for (index_t i = 0U; i < TIMER_BENCH_NODES; i++) {
+		(void)heap_delete_node(&heap, &timer_bench_nodes[i].heap_node,
+				       timer_bench_heap_compare);
+	}
+	heap_ticks = timer_get_current_timer_ticks() - start;
+
+	assert(list_is_empty(&list));
+	assert(heap_is_empty(&heap));
+
+	LOG(DEBUG, INFO,
+	    "Timer queue benchmark: {:d} timers, list {:d} ticks, heap {:d} "
+	    "ticks",
+	    TIMER_BENCH_NODES, list_ticks, heap_ticks);
+
+out:
+	return false;
+}
+#endif
+
 bool
 tests_timer(void)
 {
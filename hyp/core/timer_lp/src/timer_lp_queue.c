@@ -2,14 +2,28 @@
 //
 // SPDX-License-Identifier: BSD-3-Clause
 
+// Low power timer queues.
+//
+// When a CPU suspends, the next timeout of its arch timer queue is moved to a
+// queue for the platform's low power timer, which keeps running while the CPU
+// is suspended. There is one such queue for each group of TIMER_LP_QUEUE_CPUS
+// CPUs, each with its own lock, so CPUs in different groups can suspend and
+// resume without contending.
+//
+// The platform has only one low power timer, which must be programmed for the
+// earliest timeout in any queue. Each queue publishes its earliest timeout,
+// and the timer is reprogrammed under a separate lock only when that may
+// change the earliest timeout overall.
+
 #include <assert.h>
 #include <hyptypes.h>
 
 #include <hypcontainers.h>
 
+#include <atomic.h>
 #include <cpulocal.h>
+#include <heap.h>
 #include <ipi.h>
-#include <list.h>
 #include <platform_timer_lp.h>
 #include <preempt.h>
 #include <spinlock.h>
@@ -17,19 +31,33 @@
 
 #include "event_handlers.h"
 
-static spinlock_t	timer_lp_queue_lock;
-static timer_lp_queue_t timer_lp_queue PROTECTED_BY(timer_lp_queue_lock);
+#define TIMER_LP_NUM_QUEUES                                                    \
+	((PLATFORM_MAX_CORES + TIMER_LP_QUEUE_CPUS - 1U) / TIMER_LP_QUEUE_CPUS)
+
+static timer_lp_queue_t timer_lp_queues[TIMER_LP_NUM_QUEUES];
+
+// Held while programming the platform timer.
+static spinlock_t timer_lp_hw_lock;
+
+// The timeout the platform timer is programmed for.
+static _Atomic ticks_t timer_lp_hw_timeout;
 
 CPULOCAL_DECLARE_STATIC(timer_lp_t, timer_lp);
 
 void
 timer_lp_queue_handle_boot_cold_init(void)
 {
-	spinlock_init(&timer_lp_queue_lock);
-	spinlock_acquire(&timer_lp_queue_lock);
-	timer_lp_queue.timeout = TIMER_INVALID_TIMEOUT;
-	list_init(&timer_lp_queue.list);
-	spinlock_release(&timer_lp_queue_lock);
+	spinlock_init(&timer_lp_hw_lock);
+	atomic_init(&timer_lp_hw_timeout, TIMER_INVALID_TIMEOUT);
+
+	for (index_t i = 0U; i < TIMER_LP_NUM_QUEUES; i++) {
+		timer_lp_queue_t *queue = &timer_lp_queues[i];
+
+		spinlock_init(&queue->lock);
+		heap_init(&queue->heap);
+		atomic_init(&queue->timeout, TIMER_INVALID_TIMEOUT);
+		atomic_init(&queue->cpu_index, CPU_INDEX_INVALID);
+	}
 }
 
 void
@@ -40,8 +68,14 @@ timer_lp_queue_handle_boot_cpu_cold_init(cpu_index_t cpu_index)
 	timer->cpu_index  = cpu_index;
 }
 
+static timer_lp_queue_t *
+timer_lp_get_queue(cpu_index_t cpu_index)
+{
+	return &timer_lp_queues[(index_t)cpu_index / TIMER_LP_QUEUE_CPUS];
+}
+
 static bool
-is_timeout_a_smaller_than_b(list_node_t *node_a, list_node_t *node_b)
+is_timeout_a_smaller_than_b(heap_node_t *node_a, heap_node_t *node_b)
 {
 	bool smaller = false;
 
@@ -55,48 +89,145 @@ is_timeout_a_smaller_than_b(list_node_t *node_a, list_node_t *node_b)
 	return smaller;
 }
 
+// Publish the queue's earliest timer, after it may have changed.
 static void
-timer_lp_enqueue(timer_lp_t *timer, ticks_t timeout)
-	REQUIRE_SPINLOCK(timer_lp_queue_lock)
+timer_lp_queue_update_head(timer_lp_queue_t *queue)
+	REQUIRE_SPINLOCK(queue->lock)
 {
-	timer->timeout = timeout;
+	heap_node_t *head = heap_get_min(&queue->heap);
 
-	bool new_head = list_insert_in_order(&timer_lp_queue.list, &timer->node,
-					     is_timeout_a_smaller_than_b);
+	if (head != NULL) {
+		timer_lp_t *head_timer = timer_lp_container_of_node(head);
 
-	if (new_head) {
-		timer_lp_queue.timeout = timer->timeout;
-		platform_timer_lp_set_timeout_and_route(timer->timeout,
-							timer->cpu_index);
+		atomic_store_relaxed(&queue->cpu_index, head_timer->cpu_index);
+		atomic_store_relaxed(&queue->timeout, head_timer->timeout);
+	} else {
+		atomic_store_relaxed(&queue->timeout, TIMER_INVALID_TIMEOUT);
 	}
 }
 
-static bool
-timer_lp_dequeue(timer_lp_t *timer) REQUIRE_SPINLOCK(timer_lp_queue_lock)
+static void
+timer_lp_enqueue(timer_lp_queue_t *queue, timer_lp_t *timer, ticks_t timeout)
+	REQUIRE_SPINLOCK(queue->lock)
 {
-	bool new_head = list_delete_node(&timer_lp_queue.list, &timer->node);
-	bool need_update;
+	timer->timeout = timeout;
 
-	if (new_head) {
-		list_node_t *head	= list_get_head(&timer_lp_queue.list);
-		timer_lp_t  *head_timer = timer_lp_container_of_node(head);
+	if (heap_insert(&queue->heap, &timer->node,
+			is_timeout_a_smaller_than_b)) {
+		timer_lp_queue_update_head(queue);
+	}
+}
 
-		timer_lp_queue.timeout = head_timer->timeout;
-		need_update	       = true;
-	} else if (list_is_empty(&timer_lp_queue.list)) {
-		timer_lp_queue.timeout = TIMER_INVALID_TIMEOUT;
-		need_update	       = true;
-	} else {
-		need_update = false;
+static void
+timer_lp_dequeue(timer_lp_queue_t *queue, timer_lp_t *timer)
+	REQUIRE_SPINLOCK(queue->lock)
+{
+	if (heap_delete_node(&queue->heap, &timer->node,
+			     is_timeout_a_smaller_than_b)) {
+		timer_lp_queue_update_head(queue);
 	}
 
 	timer->timeout = TIMER_INVALID_TIMEOUT;
+}
+
+// Dequeue the queue's expired timers, and wake their CPUs.
+static void
+timer_lp_queue_expire(timer_lp_queue_t *queue, ticks_t current_ticks)
+	REQUIRE_SPINLOCK(queue->lock)
+{
+	cpu_index_t cpu_index = cpulocal_get_index();
+
+	assert_preempt_disabled();
 
-	return need_update;
+	while (atomic_load_relaxed(&queue->timeout) <= current_ticks) {
+		timer_lp_t *timer = timer_lp_container_of_node(
+			heap_get_min(&queue->heap));
+
+		timer_lp_dequeue(queue, timer);
+
+		if (timer->cpu_index != cpu_index) {
+			ipi_one(IPI_REASON_RESCHEDULE, timer->cpu_index);
+		}
+	}
+}
+
+// Returns the queue with the earliest timeout, or NULL if all are empty.
+static timer_lp_queue_t *
+timer_lp_find_earliest_queue(ticks_t *timeout)
+{
+	timer_lp_queue_t *earliest = NULL;
+
+	*timeout = TIMER_INVALID_TIMEOUT;
+
+	for (index_t i = 0U; i < TIMER_LP_NUM_QUEUES; i++) {
+		ticks_t queue_timeout =
+			atomic_load_relaxed(&timer_lp_queues[i].timeout);
+		if (queue_timeout < *timeout) {
+			earliest = &timer_lp_queues[i];
+			*timeout = queue_timeout;
+		}
+	}
+
+	return earliest;
 }
 
+// Program the platform timer for the earliest timeout in any queue.
 static void
-timer_lp_queue_save_arch_timer(void) REQUIRE_SPINLOCK(timer_lp_queue_lock)
+timer_lp_update_hw(void) REQUIRE_PREEMPT_DISABLED
+{
+	ticks_t timeout;
+	ticks_t recheck_timeout;
+
+	spinlock_acquire_nopreempt(&timer_lp_hw_lock);
+
+	do {
+		timer_lp_queue_t *queue =
+			timer_lp_find_earliest_queue(&timeout);
+
+		if (queue == NULL) {
+			platform_timer_lp_cancel_timeout();
+		} else {
+			// The CPU may be stale if the queue is changing, but
+			// the expiry handler will wake the right CPU anyway.
+			cpu_index_t cpu_index =
+				atomic_load_relaxed(&queue->cpu_index);
+			platform_timer_lp_set_timeout_and_route(timeout,
+								cpu_index);
+		}
+		atomic_store_relaxed(&timer_lp_hw_timeout, timeout);
+
+		// Fence to ensure that either a queue that has just changed
+		// sees the new platform timeout, or we see the queue's new
+		// timeout below. This matches the fence in
+		// timer_lp_queue_changed().
+		atomic_thread_fence(memory_order_seq_cst);
+
+		(void)timer_lp_find_earliest_queue(&recheck_timeout);
+	} while (recheck_timeout < timeout);
+
+	spinlock_release_nopreempt(&timer_lp_hw_lock);
+}
+
+// Reprogram the platform timer if necessary after a queue's earliest timeout
+// has changed. This must be called after releasing the queue's lock.
+static void
+timer_lp_queue_changed(ticks_t old_timeout, ticks_t new_timeout)
+	REQUIRE_PREEMPT_DISABLED
+{
+	// This matches the fence in timer_lp_update_hw().
+	atomic_thread_fence(memory_order_seq_cst);
+
+	ticks_t hw_timeout = atomic_load_relaxed(&timer_lp_hw_timeout);
+
+	// The platform timer needs to change if the queue now has the earliest
+	// timeout, or if it may have had the earliest timeout before.
+	if ((new_timeout < hw_timeout) || (old_timeout <= hw_timeout)) {
+		timer_lp_update_hw();
+	}
+}
+
+static void
+timer_lp_queue_save_arch_timer(void) REQUIRE_PREEMPT_DISABLED
 {
 	// Get the next timeout of the local arch timer queue
 
@@ -105,10 +236,19 @@ timer_lp_queue_save_arch_timer(void) REQUIRE_SPINLOCK(timer_lp_queue_lock)
 		goto out;
 	}
 
-	timer_lp_t *timer = &CPULOCAL(timer_lp);
+	timer_lp_t	 *timer = &CPULOCAL(timer_lp);
+	timer_lp_queue_t *queue = timer_lp_get_queue(timer->cpu_index);
 	assert(timer->timeout == TIMER_INVALID_TIMEOUT);
 
-	timer_lp_enqueue(timer, timeout);
+	spinlock_acquire_nopreempt(&queue->lock);
+	ticks_t old_timeout = atomic_load_relaxed(&queue->timeout);
+	timer_lp_enqueue(queue, timer, timeout);
+	ticks_t new_timeout = atomic_load_relaxed(&queue->timeout);
+	spinlock_release_nopreempt(&queue->lock);
+
+	if (new_timeout != old_timeout) {
+		timer_lp_queue_changed(old_timeout, new_timeout);
+	}
 
 out:
 	return;
@@ -122,61 +262,31 @@ timer_lp_handle_power_cpu_suspend(void)
 	// TODO: Delay or reject attempted suspend if timeout is due to expire
 	// sooner than the CPU can reach the requested power state.
 
-	spinlock_acquire_nopreempt(&timer_lp_queue_lock);
-
 	timer_lp_queue_save_arch_timer();
 
-	spinlock_release_nopreempt(&timer_lp_queue_lock);
-
 	return OK;
 }
 
 static void
-timer_lp_sync(bool force_update) REQUIRE_SPINLOCK(timer_lp_queue_lock)
-{
-	cpu_index_t cpu_index	  = cpulocal_get_index();
-	ticks_t	    current_ticks = platform_timer_lp_get_current_ticks();
-	bool	    do_update	  = force_update;
-
-	assert_preempt_disabled();
-
-	while (timer_lp_queue.timeout <= current_ticks) {
-		list_node_t *head  = list_get_head(&timer_lp_queue.list);
-		timer_lp_t  *timer = timer_lp_container_of_node(head);
-
-		(void)timer_lp_dequeue(timer);
-		// We just dequeued the head, so always update the timer
-		do_update = true;
-
-		if (timer->cpu_index != cpu_index) {
-			ipi_one(IPI_REASON_RESCHEDULE, timer->cpu_index);
-		}
-	}
-
-	if (!do_update) {
-		// Queue head didn't change, nothing to do
-	} else if (timer_lp_queue.timeout == TIMER_INVALID_TIMEOUT) {
-		// Queue is now empty
-		platform_timer_lp_cancel_timeout();
-	} else {
-		// Schedule the next timeout
-		list_node_t *head	= list_get_head(&timer_lp_queue.list);
-		timer_lp_t  *head_timer = timer_lp_container_of_node(head);
-		platform_timer_lp_set_timeout_and_route(head_timer->timeout,
-							head_timer->cpu_index);
-	}
-}
-
-static void
-timer_lp_queue_restore_arch_timer(void) REQUIRE_SPINLOCK(timer_lp_queue_lock)
+timer_lp_queue_restore_arch_timer(void) REQUIRE_PREEMPT_DISABLED
 {
 	timer_lp_t *timer = &CPULOCAL(timer_lp);
 	if (timer->timeout == TIMER_INVALID_TIMEOUT) {
 		goto out;
 	}
 
-	if (timer_lp_dequeue(timer)) {
-		timer_lp_sync(true);
+	timer_lp_queue_t *queue = timer_lp_get_queue(timer->cpu_index);
+
+	spinlock_acquire_nopreempt(&queue->lock);
+	ticks_t old_timeout = atomic_load_relaxed(&queue->timeout);
+	timer_lp_dequeue(queue, timer);
+	// Other timers in the queue may have expired while we were waking.
+	timer_lp_queue_expire(queue, platform_timer_lp_get_current_ticks());
+	ticks_t new_timeout = atomic_load_relaxed(&queue->timeout);
+	spinlock_release_nopreempt(&queue->lock);
+
+	if (new_timeout != old_timeout) {
+		timer_lp_queue_changed(old_timeout, new_timeout);
 	}
 
 out:
@@ -188,19 +298,23 @@ timer_lp_handle_power_cpu_resume(void)
 {
 	assert_preempt_disabled();
 
-	spinlock_acquire_nopreempt(&timer_lp_queue_lock);
-
 	timer_lp_queue_restore_arch_timer();
-
-	spinlock_release_nopreempt(&timer_lp_queue_lock);
 }
 
 void
 timer_lp_handle_platform_timer_lp_expiry(void)
 {
-	spinlock_acquire_nopreempt(&timer_lp_queue_lock);
+	ticks_t current_ticks = platform_timer_lp_get_current_ticks();
+
+	for (index_t i = 0U; i < TIMER_LP_NUM_QUEUES; i++) {
+		timer_lp_queue_t *queue = &timer_lp_queues[i];
 
-	timer_lp_sync(false);
+		if (atomic_load_relaxed(&queue->timeout) <= current_ticks) {
+			spinlock_acquire_nopreempt(&queue->lock);
+			timer_lp_queue_expire(queue, current_ticks);
+			spinlock_release_nopreempt(&queue->lock);
+		}
+	}
 
-	spinlock_release_nopreempt(&timer_lp_queue_lock);
+	timer_lp_update_hw();
 }
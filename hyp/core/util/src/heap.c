@@ -0,0 +1,184 @@
+// © 2021 Qualcomm Innovation Center, Inc. All rights reserved.
+//
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <assert.h>
+#include <hyptypes.h>
+
+#include <heap.h>
+
+void
+heap_init(heap_t *heap)
+{
+	assert(heap != NULL);
+
+	heap->root = NULL;
+}
+
+bool
+heap_is_empty(const heap_t *heap)
+{
+	assert(heap != NULL);
+
+	return heap->root == NULL;
+}
+
+heap_node_t *
+heap_get_min(const heap_t *heap)
+{
+	assert(heap != NULL);
+
+	return heap->root;
+}
+
+// Merge two trees, both of which must have no siblings, and return the root of
+// the merged tree. The root with the larger value becomes the first child of
+// the other.
+static heap_node_t *
+heap_meld(heap_node_t *a, heap_node_t *b,
+	  bool (*compare_fn)(heap_node_t *a, heap_node_t *b))
+{
+	assert((a->next == NULL) && (a->prev == NULL));
+	assert((b->next == NULL) && (b->prev == NULL));
+
+	heap_node_t *parent = a;
+	heap_node_t *child  = b;
+
+	if (compare_fn(b, a)) {
+		parent = b;
+		child  = a;
+	}
+
+	child->next = parent->child;
+	if (parent->child != NULL) {
+		parent->child->prev = child;
+	}
+	child->prev   = parent;
+	parent->child = child;
+
+	return parent;
+}
+
+// Merge a list of siblings into a single tree, and return its root. This is
+// the standard two-pass pairing: first meld adjacent pairs from left to right,
+// then meld the results from right to left.
+static heap_node_t *
+heap_merge_siblings(heap_node_t *first,
+		    bool (*compare_fn)(heap_node_t *a, heap_node_t *b))
+{
+	// The first pass builds a list of the melded pairs, in reverse order,
+	// linked through their next pointers.
+	heap_node_t *pairs = NULL;
+	heap_node_t *node  = first;
+
+	while (node != NULL) {
+		heap_node_t *a = node;
+		heap_node_t *b = a->next;
+
+		node	= (b != NULL) ? b->next : NULL;
+		a->next = NULL;
+		a->prev = NULL;
+		if (b != NULL) {
+			b->next = NULL;
+			b->prev = NULL;
+			a	= heap_meld(a, b, compare_fn);
+		}
+
+		a->next = pairs;
+		pairs	= a;
+	}
+
+	heap_node_t *root = NULL;
+
+	while (pairs != NULL) {
+		heap_node_t *pair = pairs;
+
+		pairs	   = pair->next;
+		pair->next = NULL;
+		root	   = (root == NULL) ? pair
+					    : heap_meld(root, pair, compare_fn);
+	}
+
+	return root;
+}
+
+bool
+heap_insert(heap_t *heap, heap_node_t *node,
+	    bool (*compare_fn)(heap_node_t *a, heap_node_t *b))
+{
+	assert(heap != NULL);
+	assert(node != NULL);
+
+	node->child = NULL;
+	node->next  = NULL;
+	node->prev  = NULL;
+
+	if (heap->root == NULL) {
+		heap->root = node;
+	} else {
+		heap->root = heap_meld(heap->root, node, compare_fn);
+	}
+
+	return heap->root == node;
+}
+
+bool
+heap_delete_node(heap_t *heap, heap_node_t *node,
+		 bool (*compare_fn)(heap_node_t *a, heap_node_t *b))
+{
+	assert(heap != NULL);
+	assert(node != NULL);
+
+	bool	     was_min  = heap->root == node;
+	heap_node_t *children = heap_merge_siblings(node->child, compare_fn);
+
+	if (was_min) {
+		heap->root = children;
+	} else {
+		// Cut the node out of its parent's list of children.
+		heap_node_t *prev = node->prev;
+		assert(prev != NULL);
+
+		if (prev->child == node) {
+			prev->child = node->next;
+		} else {
+			prev->next = node->next;
+		}
+		if (node->next != NULL) {
+			node->next->prev = prev;
+		}
+
+		if (children != NULL) {
+			heap->root = heap_meld(heap->root, children, compare_fn);
+		}
+	}
+
+	node->child = NULL;
+	node->next  = NULL;
+	node->prev  = NULL;
+
+	return was_min;
+}
+
+heap_node_t *
+heap_get_next(heap_node_t *node)
+{
+	assert(node != NULL);
+
+	heap_node_t *next = node->child;
+
+	while ((next == NULL) && (node != NULL)) {
+		next = node->next;
+		if (next == NULL) {
+			// Go back to the first sibling, whose prev pointer is
+			// the parent. The root has no parent.
+			while ((node->prev != NULL) &&
+			       (node->prev->child != node)) {
+				node = node->prev;
+			}
+			node = node->prev;
+		}
+	}
+
+	return next;
+}
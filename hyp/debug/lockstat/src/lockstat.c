@@ -0,0 +1,318 @@
+// © 2021 Qualcomm Innovation Center, Inc. All rights reserved.
+//
+// SPDX-License-Identifier: BSD-3-Clause
+
+// Lock contention statistics.
+//
+// For each spinlock, this module counts the acquisitions and contended
+// acquisitions, and sums the time spent waiting for and holding the lock. An
+// acquisition is contended if the spinlock implementation reports that it had
+// to wait, and only contended acquisitions add to the wait time. The spinlock
+// events don't identify the caller, so the statistics are kept per lock rather
+// than per call site.
+//
+// Each CPU records its own acquisitions in a small open-addressed hash table
+// keyed by the lock's address. Only the owning CPU writes to its table, from
+// the spinlock event handlers, so no locking is needed; indeed the handlers
+// must not take any spinlocks. Locks acquired after a CPU's table is full are
+// not recorded by that CPU.
+//
+// Privileged VMs can read the statistics for the most contended locks, summed
+// over all CPUs, with the lockstat_get_top hypercall. Lock addresses are not
+// exposed to the VM; debug builds report offsets into the hypervisor image,
+// which identify statically allocated locks, and other builds report opaque
+// table slot numbers.
+
+#include <assert.h>
+#include <hyptypes.h>
+
+#include <hypcall_def.h>
+#include <hypconstants.h>
+
+#include <atomic.h>
+#include <compiler.h>
+#include <cpulocal.h>
+#include <partition.h>
+#include <thread.h>
+
+#include <asm/timestamp.h>
+
+#include "event_handlers.h"
+
+CPULOCAL_DECLARE_STATIC(lockstat_cpu_t, lockstat);
+
+#if !defined(NDEBUG)
+extern const char image_virt_start;
+#endif
+
+static index_t
+lockstat_hash(const spinlock_t *lock)
+{
+	uintptr_t addr = (uintptr_t)lock;
+
+	return (index_t)((addr >> 3) ^ (addr >> 11)) &
+	       (LOCKSTAT_TABLE_SIZE - 1U);
+}
+
+static lockstat_entry_t *
+lockstat_lookup(lockstat_cpu_t *stats, const spinlock_t *lock, bool insert)
+{
+	lockstat_entry_t *entry = NULL;
+	index_t		  i	= lockstat_hash(lock);
+
+	for (count_t n = 0U; n < LOCKSTAT_TABLE_SIZE; n++) {
+		lockstat_entry_t *e	 = &stats->entries[i];
+		spinlock_t	 *e_lock = atomic_load_acquire(&e->lock);
+
+		if (e_lock == lock) {
+			entry = e;
+			break;
+		}
+		if (e_lock == NULL) {
+			if (insert) {
+				// The counters are still zero, and are only
+				// written by this CPU.
+				atomic_store_release(&e->lock,
+						     (spinlock_t *)lock);
+				entry = e;
+			}
+			break;
+		}
+
+		i = (i + 1U) & (LOCKSTAT_TABLE_SIZE - 1U);
+	}
+
+	return entry;
+}
+
+// Counters are only written by their own CPU, so a load / store pair is
+// sufficient; the atomics only prevent torn reads by other CPUs.
+static void
+lockstat_add(_Atomic uint64_t *counter, uint64_t value)
+{
+	atomic_store_relaxed(counter, atomic_load_relaxed(counter) + value);
+}
+
+void
+lockstat_handle_spinlock_acquire(spinlock_t *lock)
+{
+	lockstat_cpu_t *stats = &CPULOCAL(lockstat);
+
+	stats->wait_lock      = lock;
+	stats->wait_contended = false;
+}
+
+void
+lockstat_handle_spinlock_contended(spinlock_t *lock)
+{
+	lockstat_cpu_t *stats = &CPULOCAL(lockstat);
+
+	if (compiler_expected(stats->wait_lock == lock)) {
+		stats->wait_contended = true;
+		stats->wait_start     = arch_get_timestamp();
+	}
+}
+
+void
+lockstat_handle_spinlock_acquired(spinlock_t *lock)
+{
+	uint64_t	now   = arch_get_timestamp();
+	lockstat_cpu_t *stats = &CPULOCAL(lockstat);
+
+	if (compiler_unexpected(stats->wait_lock != lock)) {
+		goto out;
+	}
+	stats->wait_lock = NULL;
+
+	lockstat_entry_t *entry = lockstat_lookup(stats, lock, true);
+	if (entry != NULL) {
+		lockstat_add(&entry->acquired, 1U);
+		if (stats->wait_contended) {
+			lockstat_add(&entry->contended, 1U);
+			lockstat_add(&entry->wait_time,
+				     now - stats->wait_start);
+		}
+	}
+
+	if (stats->num_held < LOCKSTAT_MAX_HELD) {
+		stats->held[stats->num_held].lock  = lock;
+		stats->held[stats->num_held].start = now;
+		stats->num_held++;
+	}
+
+out:
+	return;
+}
+
+void
+lockstat_handle_spinlock_failed(spinlock_t *lock)
+{
+	lockstat_cpu_t *stats = &CPULOCAL(lockstat);
+
+	stats->wait_lock = NULL;
+
+	// A failed trylock is counted as contention, but not as an acquire.
+	lockstat_entry_t *entry = lockstat_lookup(stats, lock, true);
+	if (entry != NULL) {
+		lockstat_add(&entry->contended, 1U);
+	}
+}
+
+void
+lockstat_handle_spinlock_release(spinlock_t *lock)
+{
+	uint64_t	now   = arch_get_timestamp();
+	lockstat_cpu_t *stats = &CPULOCAL(lockstat);
+
+	// Locks are usually released in reverse order, so search from the
+	// most recently acquired.
+	for (index_t i = stats->num_held; i > 0U; i--) {
+		lockstat_held_t *held = &stats->held[i - 1U];
+		if (held->lock == lock) {
+			lockstat_entry_t *entry =
+				lockstat_lookup(stats, lock, false);
+			if (entry != NULL) {
+				lockstat_add(&entry->hold_time,
+					     now - held->start);
+			}
+
+			stats->num_held--;
+			*held = stats->held[stats->num_held];
+			break;
+		}
+	}
+}
+
+static lockstat_totals_t
+lockstat_get_totals(const spinlock_t *lock)
+{
+	lockstat_totals_t totals = { 0 };
+
+	for (cpu_index_t cpu = 0U; cpulocal_index_valid(cpu); cpu++) {
+		lockstat_entry_t *entry = lockstat_lookup(
+			&CPULOCAL_BY_INDEX(lockstat, cpu), lock, false);
+		if (entry != NULL) {
+			totals.acquired +=
+				atomic_load_relaxed(&entry->acquired);
+			totals.contended +=
+				atomic_load_relaxed(&entry->contended);
+			totals.wait_time +=
+				atomic_load_relaxed(&entry->wait_time);
+			totals.hold_time +=
+				atomic_load_relaxed(&entry->hold_time);
+		}
+	}
+
+	return totals;
+}
+
+// Locks are ranked by contention count, and then by address so the order is
+// total.
+static bool
+lockstat_ranks_below(const spinlock_t *a, uint64_t a_contended,
+		     const spinlock_t *b, uint64_t b_contended)
+{
+	return (a_contended < b_contended) ||
+	       ((a_contended == b_contended) &&
+		((uintptr_t)a < (uintptr_t)b));
+}
+
+// Returns true if the lock is recorded by a CPU before the given CPU, so each
+// lock is only considered once.
+static bool
+lockstat_seen_before(const spinlock_t *lock, cpu_index_t cpu)
+{
+	bool seen = false;
+
+	for (cpu_index_t i = 0U; !seen && (i < cpu); i++) {
+		seen = lockstat_lookup(&CPULOCAL_BY_INDEX(lockstat, i), lock,
+				       false) != NULL;
+	}
+
+	return seen;
+}
+
+// Find the highest ranked lock that ranks below the given lock, or the highest
+// ranked lock overall if prev is NULL, and the number of the first table slot
+// that records it. This is quadratic in the number of recorded locks, which is
+// acceptable for a debugging interface.
+static const spinlock_t *
+lockstat_next_lock(const spinlock_t *prev, uint64_t prev_contended,
+		   lockstat_totals_t *totals, index_t *slot)
+{
+	const spinlock_t *best = NULL;
+
+	for (cpu_index_t cpu = 0U; cpulocal_index_valid(cpu); cpu++) {
+		lockstat_cpu_t *stats = &CPULOCAL_BY_INDEX(lockstat, cpu);
+
+		for (index_t i = 0U; i < LOCKSTAT_TABLE_SIZE; i++) {
+			const spinlock_t *lock =
+				atomic_load_acquire(&stats->entries[i].lock);
+			if ((lock == NULL) || lockstat_seen_before(lock, cpu)) {
+				continue;
+			}
+
+			lockstat_totals_t t = lockstat_get_totals(lock);
+			if ((prev != NULL) &&
+			    !lockstat_ranks_below(lock, t.contended, prev,
+						  prev_contended)) {
+				continue;
+			}
+
+			if ((best == NULL) ||
+			    lockstat_ranks_below(best, totals->contended, lock,
+						 t.contended)) {
+				best	= lock;
+				*totals = t;
+				*slot	= (cpu * LOCKSTAT_TABLE_SIZE) + i;
+			}
+		}
+	}
+
+	return best;
+}
+
+hypercall_lockstat_get_top_result_t
+hypercall_lockstat_get_top(index_t rank)
+{
+	hypercall_lockstat_get_top_result_t ret = { 0 };
+
+	// Only privileged VMs (i.e. the root VM) may read the statistics.
+	if (!partition_option_flags_get_privileged(
+		    &thread_get_self()->header.partition->options)) {
+		ret.error = ERROR_DENIED;
+		goto out;
+	}
+
+	// The counters may change while we search, so a lock whose contention
+	// count changes between calls may be reported twice or skipped.
+	const spinlock_t *lock	 = NULL;
+	lockstat_totals_t totals = { 0 };
+	index_t		  slot	 = 0U;
+	for (index_t i = 0U; i <= rank; i++) {
+		lock = lockstat_next_lock(lock, totals.contended, &totals,
+					  &slot);
+		if (lock == NULL) {
+			break;
+		}
+	}
+
+	if (lock == NULL) {
+		ret.error = ERROR_ARGUMENT_INVALID;
+		goto out;
+	}
+
+#if !defined(NDEBUG)
+	ret.lock_id = (register_t)((uintptr_t)lock -
+				   (uintptr_t)&image_virt_start);
+#else
+	ret.lock_id = (register_t)slot;
+#endif
+	ret.error     = OK;
+	ret.acquired  = totals.acquired;
+	ret.contended = totals.contended;
+	ret.wait_time = totals.wait_time;
+	ret.hold_time = totals.hold_time;
+out:
+	return ret;
+}
@@ -2,14 +2,28 @@
 //
 // SPDX-License-Identifier: BSD-3-Clause
 
+// Mutexes are locks that may be held for a long time, such as across
+// operations on large address ranges.
+//
+// Depending on the implementation, a thread waiting for a mutex either blocks,
+// or spins with preemption disabled. Callers must therefore be in thread
+// context with preemption enabled, and must not hold any spinlocks. Whether
+// preemption is disabled while the mutex is held also depends on the
+// implementation, so the holder must not rely on it either way.
+
+// Initialise a mutex structure.
 void
 mutex_init(mutex_t *lock);
 
+// Acquire exclusive ownership of a mutex, waiting until it is available.
 void
 mutex_acquire(mutex_t *lock) ACQUIRE_LOCK(lock);
 
+// Attempt to immediately acquire exclusive ownership of a mutex, and return
+// true if it succeeds.
 bool
 mutex_trylock(mutex_t *lock) TRY_ACQUIRE_LOCK(true, lock);
 
+// Release a mutex held by the caller.
 void
 mutex_release(mutex_t *lock) RELEASE_LOCK(lock);
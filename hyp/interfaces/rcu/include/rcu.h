@@ -42,6 +42,33 @@ rcu_enqueue(rcu_entry_t *rcu_entry, rcu_update_class_t rcu_update_class);
 void
 rcu_sync(void);
 
+// Block until the current grace period ends, forcing it to end quickly.
+//
+// This has the same semantics as rcu_sync(). However, rather than waiting for
+// other CPUs to pass through quiescent states in the normal course of events,
+// it interrupts every CPU that is executing in the hypervisor to force them to
+// do so. This is much faster on a busy system, but more expensive overall, so
+// it should only be used where the latency of the caller is visible to a VM.
+void
+rcu_sync_expedited(void);
+
+// Start expediting grace periods.
+//
+// Until the matching call to rcu_expedite_finish(), each grace period will
+// force all active CPUs through a quiescent state as soon as it starts. Calls
+// may be nested or made concurrently from several CPUs.
+//
+// This is a helper for rcu_sync_expedited(), and is not intended to be called
+// directly.
+void
+rcu_expedite_start(void);
+
+// Stop expediting grace periods.
+//
+// This reverses the effect of the most recent unmatched rcu_expedite_start().
+void
+rcu_expedite_finish(void);
+
 // Block until the next grace period ends or the caller is killed.
 //
 // If this call returns true, it has the same semantics as rcu_sync(). If it
@@ -252,6 +252,16 @@ error_t
 scheduler_set_affinity(thread_t *thread, cpu_index_t target_cpu)
 	REQUIRE_SCHEDULER_LOCK(thread);
 
+// Set the affinity of a thread to any CPU in the same cluster as the specified
+// CPU.
+//
+// The same requirements apply as for scheduler_set_affinity(). The thread's
+// current affinity is kept if it is already in the cluster; otherwise the CPU
+// it last ran on is preferred, and then the least loaded CPU in the cluster.
+error_t
+scheduler_set_affinity_cluster(thread_t *thread, cpu_index_t cluster_cpu)
+	REQUIRE_SCHEDULER_LOCK(thread);
+
 error_t
 scheduler_set_priority(thread_t *thread, priority_t priority)
 	REQUIRE_SCHEDULER_LOCK(thread);
@@ -260,6 +270,111 @@ error_t
 scheduler_set_timeslice(thread_t *thread, nanoseconds_t timeslice)
 	REQUIRE_SCHEDULER_LOCK(thread);
 
+// Set or clear a thread's deadline reservation.
+//
+// A thread with a reservation may run for up to the given budget in each
+// period, and will be scheduled by earliest deadline ahead of any thread that
+// is scheduled by priority. Once the budget is exhausted, the thread runs at
+// its normal priority until the next period. A period of zero removes the
+// reservation; the budget and deadline must also be zero in that case.
+//
+// Returns ERROR_NORESOURCES if the thread's CPU cannot accept the reservation.
+// The caller must hold the scheduling lock for the thread.
+error_t
+scheduler_set_deadline(thread_t *thread, nanoseconds_t period,
+		       nanoseconds_t budget, nanoseconds_t deadline)
+	REQUIRE_SCHEDULER_LOCK(thread);
+
+// Set or clear a thread's CPU bandwidth quota.
+//
+// A thread with a quota may run for up to the given budget in each period.
+// Once the budget is exhausted, the thread is blocked until the end of the
+// period. A period of zero removes the quota; the budget must also be zero in
+// that case.
+//
+// Returns ERROR_BUSY if the thread is running or throttled. The caller must
+// hold the scheduling lock for the thread.
+error_t
+scheduler_set_quota(thread_t *thread, nanoseconds_t period,
+		    nanoseconds_t budget) REQUIRE_SCHEDULER_LOCK(thread);
+
+// Set the priority boost applied to a VCPU when it is woken by an interrupt.
+//
+// The boost is added to the thread's priority until it blocks or its
+// timeslice expires. Each time a boosted thread runs out its timeslice, the
+// boost given on subsequent wakeups is halved, until the thread blocks while
+// still boosted. A boost of zero disables boosting.
+//
+// Returns ERROR_ARGUMENT_INVALID if the boost exceeds SCHEDULER_MAX_IRQ_BOOST.
+// The caller must hold the scheduling lock for the thread.
+error_t
+scheduler_set_irq_boost(thread_t *thread, priority_t boost)
+	REQUIRE_SCHEDULER_LOCK(thread);
+
+// Set the priority a thread inherits from threads waiting for a lock it holds.
+//
+// The thread is scheduled at the greater of its own priority and the inherited
+// priority, so an inherited priority of SCHEDULER_MIN_PRIORITY has no effect.
+// The caller must hold the scheduling lock for the thread.
+void
+scheduler_set_inherited_priority(thread_t *thread, priority_t priority)
+	REQUIRE_SCHEDULER_LOCK(thread);
+
+// Return the priority a thread is currently scheduled at, including any
+// inherited priority or temporary boost.
+//
+// The caller must hold the scheduling lock for the thread.
+priority_t
+scheduler_get_effective_priority(thread_t *thread)
+	REQUIRE_SCHEDULER_LOCK(thread);
+
+// Ask for the specified thread to be run as soon as possible on its affinity
+// CPU, because related threads are running on other CPUs (gang scheduling).
+//
+// This is a hint. If the thread is waiting to run on a remote CPU, that CPU
+// will prefer it to other threads of the same or lower priority the next time
+// it schedules, which will be triggered by an IPI. Otherwise, there is no
+// effect.
+//
+// The caller must either hold a reference to the specified thread or be in an
+// RCU read-side critical section, and must not hold any scheduler locks.
+void
+scheduler_gang_start(thread_t *thread);
+
+// Ask for the specified thread to stop running on its affinity CPU, because
+// related threads have been preempted on other CPUs (gang scheduling).
+//
+// This is a hint. If the thread is running on a remote CPU, its timeslice will
+// be ended and that CPU will be triggered to reschedule. Otherwise, there is
+// no effect.
+//
+// The caller must either hold a reference to the specified thread or be in an
+// RCU read-side critical section, and must not hold any scheduler locks.
+void
+scheduler_gang_stop(thread_t *thread);
+
+// Returns true if the specified CPU is in isolated mode.
+//
+// An isolated CPU is dedicated to its assigned threads. Other modules should
+// avoid sending deferred work to it, and move work that it generates to a
+// housekeeping CPU where possible.
+bool
+scheduler_is_cpu_isolated(cpu_index_t cpu);
+
+// Returns a housekeeping (i.e. non-isolated) CPU that may run work offloaded
+// from the specified CPU, preferring one in the same cluster.
+//
+// Returns CPU_INDEX_INVALID if there is no such CPU.
+cpu_index_t
+scheduler_get_housekeeping_cpu(cpu_index_t cpu);
+
+// Put the specified CPU into or out of isolated mode.
+//
+// The change takes effect asynchronously on the specified CPU. Returns
+// ERROR_DENIED if isolating the CPU would leave no housekeeping CPUs.
+error_t
+scheduler_set_cpu_isolated(cpu_index_t cpu, bool isolated);
+
 // Returns true if the specified thread has sufficient priority to immediately
 // preempt the currently running thread.
 //
@@ -0,0 +1,72 @@
+// © 2021 Qualcomm Innovation Center, Inc. All rights reserved.
+//
+// SPDX-License-Identifier: BSD-3-Clause
+
+// Reader-writer spinlocks.
+//
+// These allow any number of readers to hold the lock at once, or a single
+// writer. They are fair: a writer waits for readers that arrived before it, and
+// readers that arrive while a writer is waiting or present wait for at most one
+// writer. They should only be used for data that is read far more often than
+// it is written; otherwise a plain spinlock is cheaper.
+//
+// Read locks are not recursive; a reader that tries to reacquire a read lock
+// it already holds may deadlock with a waiting writer.
+
+// Initialise a reader-writer lock structure.
+//
+// This must be called exactly once for each lock, before any of the functions
+// below are called.
+void
+rwlock_init(rwlock_t *lock);
+
+// Acquire shared read ownership of a lock, spinning until any writer that is
+// present or waiting has released it. Preemption will be disabled.
+void
+rwlock_read_acquire(rwlock_t *lock) ACQUIRE_RWLOCK_READ(lock);
+
+// Release shared read ownership of a lock. Preemption will be enabled.
+void
+rwlock_read_release(rwlock_t *lock) RELEASE_RWLOCK_READ(lock);
+
+// Acquire exclusive write ownership of a lock, spinning until all earlier
+// writers and all readers have released it. Preemption will be disabled.
+void
+rwlock_write_acquire(rwlock_t *lock) ACQUIRE_RWLOCK_WRITE(lock);
+
+// Release exclusive write ownership of a lock. Preemption will be enabled.
+void
+rwlock_write_release(rwlock_t *lock) RELEASE_RWLOCK_WRITE(lock);
+
+// As for rwlock_read_acquire(), but preemption must already be disabled and
+// will not be disabled again.
+void
+rwlock_read_acquire_nopreempt(rwlock_t *lock) ACQUIRE_RWLOCK_READ_NP(lock);
+
+// As for rwlock_read_release(), but preemption will not be enabled.
+void
+rwlock_read_release_nopreempt(rwlock_t *lock) RELEASE_RWLOCK_READ_NP(lock);
+
+// As for rwlock_write_acquire(), but preemption must already be disabled and
+// will not be disabled again.
+void
+rwlock_write_acquire_nopreempt(rwlock_t *lock) ACQUIRE_RWLOCK_WRITE_NP(lock);
+
+// As for rwlock_write_release(), but preemption will not be enabled.
+void
+rwlock_write_release_nopreempt(rwlock_t *lock) RELEASE_RWLOCK_WRITE_NP(lock);
+
+// Assert that a specific lock is held by the caller, either for reading or for
+// writing.
+//
+// This might only be a static check, especially in non-debug builds.
+void
+assert_rwlock_read_held(const rwlock_t *lock) REQUIRE_READ(lock)
+	REQUIRE_PREEMPT_DISABLED;
+
+// Assert that a specific lock is held by the caller for writing.
+//
+// This might only be a static check, especially in non-debug builds.
+void
+assert_rwlock_write_held(const rwlock_t *lock) REQUIRE_LOCK(lock)
+	REQUIRE_PREEMPT_DISABLED;
@@ -0,0 +1,84 @@
+// © 2021 Qualcomm Innovation Center, Inc. All rights reserved.
+//
+// SPDX-License-Identifier: BSD-3-Clause
+
+// Sequence locks.
+//
+// A sequence lock protects a small amount of data that is read far more often
+// than it is written, such as a time base. Readers never write to the lock, so
+// they don't contend with each other for its cache line. Instead, they read
+// the data optimistically, and retry if a writer changed it meanwhile:
+//
+//	count_t seq;
+//	do {
+//		seq   = seqlock_read_start(&lock);
+//		value = atomic_load_relaxed(&data);
+//	} while (seqlock_read_retry(&lock, seq));
+//
+// Since readers may race with a writer, the protected data must be accessed
+// with relaxed atomic operations, and readers must not act on the values they
+// read until seqlock_read_retry() returns false.
+//
+// Writers are serialised by a spinlock, and have preemption disabled, so a
+// reader can only wait for a writer on another CPU.
+
+#include <atomic.h>
+#include <compiler.h>
+#include <spinlock.h>
+
+#include <asm/event.h>
+
+// Initialise a sequence lock structure.
+static inline void
+seqlock_init(seqlock_t *lock)
+{
+	atomic_init(&lock->seq, 0U);
+	spinlock_init(&lock->lock);
+}
+
+// Begin a read-side section, and return the sequence count to pass to
+// seqlock_read_retry(). This waits for any write in progress to finish.
+static inline count_t
+seqlock_read_start(seqlock_t *lock)
+{
+	count_t seq = asm_event_load_before_wait(&lock->seq);
+
+	while (compiler_unexpected((seq & 1U) != 0U)) {
+		asm_event_wait(&lock->seq);
+		seq = asm_event_load_before_wait(&lock->seq);
+	}
+
+	return seq;
+}
+
+// End a read-side section. Returns true if a writer may have changed the data
+// since the matching seqlock_read_start(), in which case the values read must
+// be discarded and the section repeated.
+static inline bool
+seqlock_read_retry(seqlock_t *lock, count_t seq)
+{
+	atomic_thread_fence(memory_order_acquire);
+
+	return atomic_load_relaxed(&lock->seq) != seq;
+}
+
+// Begin a write-side section. Preemption will be disabled.
+static inline void
+seqlock_write_start(seqlock_t *lock) ACQUIRE_SPINLOCK(&lock->lock)
+{
+	spinlock_acquire(&lock->lock);
+
+	count_t seq = atomic_load_relaxed(&lock->seq);
+	atomic_store_relaxed(&lock->seq, seq + 1U);
+	atomic_thread_fence(memory_order_release);
+}
+
+// End a write-side section. Preemption will be enabled.
+static inline void
+seqlock_write_finish(seqlock_t *lock) RELEASE_SPINLOCK(&lock->lock)
+{
+	count_t seq = atomic_load_relaxed(&lock->seq);
+	asm_event_store_and_wake(&lock->seq, seq + 1U);
+
+	spinlock_release(&lock->lock);
+}
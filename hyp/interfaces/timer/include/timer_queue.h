@@ -10,11 +10,20 @@
 void
 timer_init_object(timer_t *timer, timer_action_t action);
 
+// Set the number of ticks by which a timer may fire late. This allows its
+// expiry to be handled by the same interrupt as other timers with nearby
+// timeouts. The default is zero. The timer must not be queued.
+void
+timer_set_slack(timer_t *timer, ticks_t slack);
+
 // Returns whether this timer already belongs to a queue
 bool
 timer_is_queued(timer_t *timer);
 
-// Add a timer object to this CPU's queue with the given absolute timeout
+// Add a timer object to this CPU's queue with the given absolute timeout.
+//
+// If this CPU is isolated, the timer may be queued on a housekeeping CPU
+// instead, unless its action is CPU-local (see timer_action_is_cpu_local).
 void
 timer_enqueue(timer_t *timer, ticks_t timeout);
 
@@ -23,7 +32,8 @@ void
 timer_dequeue(timer_t *timer);
 
 // Update a timer object with a new absolute timeout. This will add the
-// timer to this CPU's queue if not already queued.
+// timer to this CPU's queue if not already queued, subject to the same
+// isolation rules as timer_enqueue().
 void
 timer_update(timer_t *timer, ticks_t timeout);
 
@@ -43,6 +53,7 @@ timer_convert_ns_to_ticks(nanoseconds_t ns);
 nanoseconds_t
 timer_convert_ticks_to_ns(ticks_t ticks);
 
-// Get next timeout from cpu local queue
+// Get next timeout from cpu local queue. This includes the queued timers'
+// slack, so it is the latest time at which the CPU must handle its timers.
 ticks_t
 timer_queue_get_next_timeout(void) REQUIRE_PREEMPT_DISABLED;
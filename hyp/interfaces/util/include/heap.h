@@ -0,0 +1,41 @@
+// © 2021 Qualcomm Innovation Center, Inc. All rights reserved.
+//
+// SPDX-License-Identifier: BSD-3-Clause
+
+// The heap implementation is a pairing heap, ordered by a comparison function
+// provided by the caller. It takes constant time to insert a node or find the
+// minimum node, and amortised logarithmic time to delete a node.
+
+// All the following functions require the heap to be locked if it may be
+// accessed by other threads.
+//
+// The compare_fn argument must return true if node a is smaller than node b,
+// and must be the same for every call on a given heap. Nodes that compare
+// equal are not returned in any particular order.
+
+void
+heap_init(heap_t *heap);
+
+bool
+heap_is_empty(const heap_t *heap);
+
+// Returns the smallest node, or NULL if the heap is empty.
+heap_node_t *
+heap_get_min(const heap_t *heap);
+
+// Returns true if the new node is now the smallest node.
+bool
+heap_insert(heap_t *heap, heap_node_t *node,
+	    bool (*compare_fn)(heap_node_t *a, heap_node_t *b));
+
+// Returns true if the deleted node was the smallest node, in which case the
+// smallest node may have changed.
+bool
+heap_delete_node(heap_t *heap, heap_node_t *node,
+		 bool (*compare_fn)(heap_node_t *a, heap_node_t *b));
+
+// Returns the node after the specified node in an arbitrary but complete
+// traversal of the heap, which starts at heap_get_min(). Returns NULL after
+// the last node. The heap must not be modified during the traversal.
+heap_node_t *
+heap_get_next(heap_node_t *node);
@@ -872,6 +872,9 @@ gicv3_handle_boot_cold_init(cpu_index_t cpu)
 			// by 'power_cpu_online' handler
 			gicr_cpu_t *gc = &CPULOCAL_BY_INDEX(gicr_cpu, i);
 			gc->online     = (i == cpu);
+#if GICV3_HAS_1N
+			spinlock_init(&gc->dpg_lock);
+#endif
 		}
 	}
 
@@ -2036,6 +2039,35 @@ platform_ipi_one(cpu_index_t cpu)
 }
 #endif
 
+#if GICV3_HAS_1N
+static void
+gicr_update_dpg1ns(gicr_cpu_t *gicr_cpu) REQUIRE_SPINLOCK(gicr_cpu->dpg_lock)
+{
+	// 1-of-N SPIs are only delivered to a CPU if it is not isolated and
+	// its HLOS VCPU (if any) has not been powered off. We are assuming
+	// here that DPGs are implemented.
+	bool disable = gicr_cpu->isolated || gicr_cpu->hlos_vcpu_off;
+
+	GICR_CTLR_t gicr_ctlr = atomic_load_relaxed(&gicr_cpu->gicr->rd.ctlr);
+	GICR_CTLR_set_DPG1NS(&gicr_ctlr, disable);
+	atomic_store_relaxed(&gicr_cpu->gicr->rd.ctlr, gicr_ctlr);
+}
+
+void
+gicv3_handle_scheduler_cpu_isolation_changed(bool isolated)
+{
+	gicr_cpu_t *gicr_cpu = &CPULOCAL(gicr_cpu);
+
+	// Remove isolated CPUs from 1-of-N SPI delivery, so the GICD sends
+	// those interrupts to the housekeeping CPUs instead. Directly routed
+	// SPIs are left alone; they follow the VCPUs they are routed to.
+	spinlock_acquire_nopreempt(&gicr_cpu->dpg_lock);
+	gicr_cpu->isolated = isolated;
+	gicr_update_dpg1ns(gicr_cpu);
+	spinlock_release_nopreempt(&gicr_cpu->dpg_lock);
+}
+#endif
+
 #if defined(INTERFACE_VCPU) && INTERFACE_VCPU && GICV3_HAS_1N
 
 error_t
@@ -2044,15 +2076,16 @@ gicv3_handle_vcpu_poweron(thread_t *vcpu)
 	if (vcpu_option_flags_get_hlos_vm(&vcpu->vcpu_options)) {
 		cpu_index_t cpu = scheduler_get_affinity(vcpu);
 
-		// Enable 1-of-N targeting to the VCPU's physical CPU.
+		// Enable 1-of-N targeting to the VCPU's physical CPU, unless
+		// it is isolated.
 		//
-		// No locking, because we assume that the hlos_vm flag is only
-		// set on one VCPU per physical CPU. Also we are assuming here
-		// that DPGs are implemented.
-		gicr_t	   *gicr      = CPULOCAL_BY_INDEX(gicr_cpu, cpu).gicr;
-		GICR_CTLR_t gicr_ctlr = atomic_load_relaxed(&gicr->rd.ctlr);
-		GICR_CTLR_set_DPG1NS(&gicr_ctlr, false);
-		atomic_store_relaxed(&gicr->rd.ctlr, gicr_ctlr);
+		// We assume that the hlos_vm flag is only set on one VCPU per
+		// physical CPU.
+		gicr_cpu_t *gicr_cpu = &CPULOCAL_BY_INDEX(gicr_cpu, cpu);
+		spinlock_acquire_nopreempt(&gicr_cpu->dpg_lock);
+		gicr_cpu->hlos_vcpu_off = false;
+		gicr_update_dpg1ns(gicr_cpu);
+		spinlock_release_nopreempt(&gicr_cpu->dpg_lock);
 	}
 
 	return OK;
@@ -2066,13 +2099,13 @@ gicv3_handle_vcpu_poweroff(thread_t *vcpu)
 
 		// Disable 1-of-N targeting to the VCPU's physical CPU.
 		//
-		// No locking, because we assume that the hlos_vm flag is only
-		// set on one VCPU per physical CPU. Also we are assuming here
-		// that DPGs are implemented.
-		gicr_t	   *gicr      = CPULOCAL_BY_INDEX(gicr_cpu, cpu).gicr;
-		GICR_CTLR_t gicr_ctlr = atomic_load_relaxed(&gicr->rd.ctlr);
-		GICR_CTLR_set_DPG1NS(&gicr_ctlr, true);
-		atomic_store_relaxed(&gicr->rd.ctlr, gicr_ctlr);
+		// We assume that the hlos_vm flag is only set on one VCPU per
+		// physical CPU.
+		gicr_cpu_t *gicr_cpu = &CPULOCAL_BY_INDEX(gicr_cpu, cpu);
+		spinlock_acquire_nopreempt(&gicr_cpu->dpg_lock);
+		gicr_cpu->hlos_vcpu_off = true;
+		gicr_update_dpg1ns(gicr_cpu);
+		spinlock_release_nopreempt(&gicr_cpu->dpg_lock);
 	}
 
 	return OK;
@@ -26,10 +26,15 @@ arm_vm_timer_handle_object_create_thread(thread_create_t thread_create)
 	assert(thread != NULL);
 
 	if (thread->kind == THREAD_KIND_VCPU) {
+		ticks_t slack =
+			timer_convert_ns_to_ticks(ARM_VM_TIMER_SLACK_NS);
+
 		timer_init_object(&thread->virtual_timer,
 				  TIMER_ACTION_VIRTUAL_TIMER);
+		timer_set_slack(&thread->virtual_timer, slack);
 		timer_init_object(&thread->physical_timer,
 				  TIMER_ACTION_PHYSICAL_TIMER);
+		timer_set_slack(&thread->physical_timer, slack);
 	}
 
 	return OK;
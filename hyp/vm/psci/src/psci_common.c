@@ -207,6 +207,14 @@ psci_handle_scheduler_affinity_changed_sync(thread_t   *thread,
 	}
 }
 
+bool
+psci_handle_scheduler_affinity_change_needs_sync(const thread_t *thread)
+{
+	// The VCPU must be added to its new CPU's power management list after
+	// a grace period; see psci_handle_scheduler_affinity_changed().
+	return thread->vpm_mode == VPM_MODE_PSCI;
+}
+
 static bool
 psci_mpidr_matches_thread(MPIDR_EL1_t a, psci_mpidr_t b)
 {
@@ -1311,6 +1319,66 @@ psci_handle_vcpu_stopped(void)
 	}
 }
 
+static bool
+psci_is_gang_vcpu(const thread_t *thread)
+{
+	return (thread->kind == THREAD_KIND_VCPU) &&
+	       (thread->psci_group != NULL) &&
+	       vpm_group_option_flags_get_gang_schedule(
+		       &thread->psci_group->options);
+}
+
+static void
+psci_gang_update(const thread_t *thread, bool start) REQUIRE_RCU_READ
+{
+	vpm_group_t *psci_group = thread->psci_group;
+
+	for (index_t i = 0U; i < util_array_size(psci_group->psci_cpus); i++) {
+		thread_t *sibling =
+			atomic_load_consume(&psci_group->psci_cpus[i]);
+		if ((sibling == NULL) || (sibling == thread)) {
+			continue;
+		}
+
+		if (start) {
+			scheduler_gang_start(sibling);
+		} else {
+			scheduler_gang_stop(sibling);
+		}
+	}
+}
+
+void
+psci_handle_scheduler_selected_thread_gang(thread_t *thread)
+{
+	thread_t *current = thread_get_self();
+
+	// Switches between VCPUs in the same group don't change the set of
+	// running VCPUs on other CPUs.
+	if ((thread == current) || (thread->psci_group == current->psci_group)) {
+		goto out;
+	}
+
+	if (psci_is_gang_vcpu(current)) {
+		// Only deschedule the rest of the gang if this VCPU has been
+		// preempted; VCPUs that block don't need the others to stop.
+		scheduler_lock_nopreempt(current);
+		bool preempted = scheduler_is_runnable(current);
+		scheduler_unlock_nopreempt(current);
+
+		if (preempted) {
+			psci_gang_update(current, false);
+		}
+	}
+
+	if (psci_is_gang_vcpu(thread)) {
+		psci_gang_update(thread, true);
+	}
+
+out:
+	return;
+}
+
 void
 psci_handle_power_cpu_online(void)
 {
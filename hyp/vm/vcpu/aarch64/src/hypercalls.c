@@ -215,6 +215,52 @@ out:
 	return ret;
 }
 
+error_t
+hypercall_vcpu_set_affinity_cluster(cap_id_t cap_id, cpu_index_t affinity)
+{
+	error_t	  ret;
+	cspace_t *cspace = cspace_get_self();
+
+	if (!platform_cpu_exists(affinity)) {
+		ret = ERROR_ARGUMENT_INVALID;
+		goto out;
+	}
+
+	thread_ptr_result_t result = cspace_lookup_thread_any(
+		cspace, cap_id, CAP_RIGHTS_THREAD_AFFINITY);
+	if (compiler_unexpected(result.e != OK)) {
+		ret = result.e;
+		goto out;
+	}
+
+	thread_t *vcpu = result.r;
+
+	if (compiler_unexpected(vcpu->kind != THREAD_KIND_VCPU)) {
+		ret = ERROR_ARGUMENT_INVALID;
+		object_put_thread(vcpu);
+		goto out;
+	}
+
+	spinlock_acquire(&vcpu->header.lock);
+	object_state_t state = atomic_load_relaxed(&vcpu->header.state);
+#if SCHEDULER_CAN_MIGRATE
+	if ((state == OBJECT_STATE_INIT) || (state == OBJECT_STATE_ACTIVE)) {
+#else
+	if (state == OBJECT_STATE_INIT) {
+#endif
+		scheduler_lock_nopreempt(vcpu);
+		ret = scheduler_set_affinity_cluster(vcpu, affinity);
+		scheduler_unlock_nopreempt(vcpu);
+	} else {
+		ret = ERROR_OBJECT_STATE;
+	}
+	spinlock_release(&vcpu->header.lock);
+
+	object_put_thread(vcpu);
+out:
+	return ret;
+}
+
 error_t
 hypercall_vcpu_poweron(cap_id_t cap_id, uint64_t entry_point, uint64_t context,
 		       vcpu_poweron_flags_t flags)
@@ -392,6 +438,114 @@ out:
 	return ret;
 }
 
+error_t
+hypercall_vcpu_set_deadline(cap_id_t cap_id, nanoseconds_t period,
+			    nanoseconds_t budget, nanoseconds_t deadline)
+{
+	error_t	  ret;
+	cspace_t *cspace = cspace_get_self();
+
+	thread_ptr_result_t result = cspace_lookup_thread_any(
+		cspace, cap_id, CAP_RIGHTS_THREAD_PRIORITY);
+	if (compiler_unexpected(result.e != OK)) {
+		ret = result.e;
+		goto out;
+	}
+
+	thread_t *vcpu = result.r;
+
+	if (compiler_unexpected(vcpu->kind != THREAD_KIND_VCPU)) {
+		ret = ERROR_ARGUMENT_INVALID;
+		object_put_thread(vcpu);
+		goto out;
+	}
+
+	spinlock_acquire(&vcpu->header.lock);
+	object_state_t state = atomic_load_relaxed(&vcpu->header.state);
+	if (state == OBJECT_STATE_INIT) {
+		scheduler_lock_nopreempt(vcpu);
+		ret = scheduler_set_deadline(vcpu, period, budget, deadline);
+		scheduler_unlock_nopreempt(vcpu);
+	} else {
+		ret = ERROR_OBJECT_STATE;
+	}
+	spinlock_release(&vcpu->header.lock);
+
+	object_put_thread(vcpu);
+out:
+	return ret;
+}
+
+error_t
+hypercall_vcpu_set_quota(cap_id_t cap_id, nanoseconds_t period,
+			 nanoseconds_t budget)
+{
+	error_t	  ret;
+	cspace_t *cspace = cspace_get_self();
+
+	thread_ptr_result_t result = cspace_lookup_thread_any(
+		cspace, cap_id, CAP_RIGHTS_THREAD_PRIORITY);
+	if (compiler_unexpected(result.e != OK)) {
+		ret = result.e;
+		goto out;
+	}
+
+	thread_t *vcpu = result.r;
+
+	if (compiler_unexpected(vcpu->kind != THREAD_KIND_VCPU)) {
+		ret = ERROR_ARGUMENT_INVALID;
+		object_put_thread(vcpu);
+		goto out;
+	}
+
+	spinlock_acquire(&vcpu->header.lock);
+	object_state_t state = atomic_load_relaxed(&vcpu->header.state);
+	if (state == OBJECT_STATE_INIT) {
+		scheduler_lock_nopreempt(vcpu);
+		ret = scheduler_set_quota(vcpu, period, budget);
+		scheduler_unlock_nopreempt(vcpu);
+	} else {
+		ret = ERROR_OBJECT_STATE;
+	}
+	spinlock_release(&vcpu->header.lock);
+
+	object_put_thread(vcpu);
+out:
+	return ret;
+}
+
+error_t
+hypercall_vcpu_set_irq_boost(cap_id_t cap_id, priority_t boost)
+{
+	error_t	  ret;
+	cspace_t *cspace = cspace_get_self();
+
+	thread_ptr_result_t result = cspace_lookup_thread_any(
+		cspace, cap_id, CAP_RIGHTS_THREAD_PRIORITY);
+	if (compiler_unexpected(result.e != OK)) {
+		ret = result.e;
+		goto out;
+	}
+
+	thread_t *vcpu = result.r;
+
+	if (compiler_unexpected(vcpu->kind != THREAD_KIND_VCPU)) {
+		ret = ERROR_ARGUMENT_INVALID;
+		object_put_thread(vcpu);
+		goto out;
+	}
+
+	// The boost only takes effect on the next interrupt wakeup, so it
+	// may be changed at any time.
+	scheduler_lock(vcpu);
+	ret = scheduler_set_irq_boost(vcpu, boost);
+	scheduler_unlock(vcpu);
+
+	object_put_thread(vcpu);
+out:
+	return ret;
+}
+
 error_t
 hypercall_vcpu_kill(cap_id_t cap_id)
 {
@@ -16,7 +16,7 @@
 #include <object.h>
 #include <partition.h>
 #include <platform_timer.h>
-#include <preempt.h>
+#include <seqlock.h>
 #include <spinlock.h>
 #include <util.h>
 
@@ -68,18 +68,18 @@ hypercall_vrtc_set_time_base(cap_id_t vrtc_cap, nanoseconds_t time_base,
 	}
 	vrtc_t *vrtc = vrtc_r.r;
 
-	if (vrtc->time_base != 0U) {
+	seqlock_write_start(&vrtc->time_lock);
+	if (atomic_load_relaxed(&vrtc->time_base) != 0U) {
 		// The time base has already been set once
 		err = ERROR_BUSY;
-		goto out_put_vrtc;
+		goto out_unlock;
 	}
 
-	preempt_disable();
 	ticks_t now = platform_timer_get_current_ticks();
 	if (now < sys_timer_ref) {
 		// The snapshot was taken in the future?!
 		err = ERROR_ARGUMENT_INVALID;
-		goto out_preempt;
+		goto out_unlock;
 	}
 
 	ticks_t time_base_ticks = platform_timer_convert_ns_to_ticks(time_base);
@@ -88,12 +88,14 @@ hypercall_vrtc_set_time_base(cap_id_t vrtc_cap, nanoseconds_t time_base,
 	// "sys_timer_ref" instead of "now" we account for the time delta
 	// between the moment the snapshot was taken and the moment the
 	// hypercall is handled in the hypervisor.
-	vrtc->time_base = time_base_ticks - sys_timer_ref;
-	vrtc->lr	= (rtc_seconds_t)(time_base / TIMER_NANOSECS_IN_SECOND);
-
-out_preempt:
-	preempt_enable();
-out_put_vrtc:
+	atomic_store_relaxed(&vrtc->time_base,
+			     time_base_ticks - sys_timer_ref);
+	atomic_store_relaxed(&vrtc->lr,
+			     (rtc_seconds_t)(time_base /
+					     TIMER_NANOSECS_IN_SECOND));
+
+out_unlock:
+	seqlock_write_finish(&vrtc->time_lock);
 	object_put_vrtc(vrtc);
 out:
 	return err;
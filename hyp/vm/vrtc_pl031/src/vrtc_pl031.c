@@ -11,8 +11,7 @@
 #include <object.h>
 #include <panic.h>
 #include <platform_timer.h>
-#include <preempt.h>
-#include <spinlock.h>
+#include <seqlock.h>
 #include <thread.h>
 #include <util.h>
 #include <vic.h>
@@ -25,9 +24,10 @@ vrtc_pl031_handle_object_create_vrtc(vrtc_create_t params)
 	vrtc_t *vrtc = params.vrtc;
 	assert(vrtc != NULL);
 
-	vrtc->ipa	= VMADDR_INVALID;
-	vrtc->lr	= 0;
-	vrtc->time_base = 0;
+	vrtc->ipa = VMADDR_INVALID;
+	atomic_init(&vrtc->lr, 0U);
+	atomic_init(&vrtc->time_base, 0U);
+	seqlock_init(&vrtc->time_lock);
 
 	return OK;
 }
@@ -64,12 +64,25 @@ static void
 vrtc_pl031_reg_read(vrtc_t *vrtc, size_t offset, register_t *value)
 {
 	if (offset == offsetof(vrtc_pl031_t, RTCDR)) {
+		ticks_t time_base;
+		count_t seq;
+		do {
+			seq	  = seqlock_read_start(&vrtc->time_lock);
+			time_base = atomic_load_relaxed(&vrtc->time_base);
+		} while (seqlock_read_retry(&vrtc->time_lock, seq));
+
 		uint64_t now = platform_timer_get_current_ticks();
-		*value = platform_timer_convert_ticks_to_ns(vrtc->time_base +
-							    now) /
+		*value = platform_timer_convert_ticks_to_ns(time_base + now) /
 			 TIMER_NANOSECS_IN_SECOND;
 	} else if (offset == offsetof(vrtc_pl031_t, RTCLR)) {
-		*value = vrtc->lr;
+		rtc_seconds_t lr;
+		count_t	      seq;
+		do {
+			seq = seqlock_read_start(&vrtc->time_lock);
+			lr  = atomic_load_relaxed(&vrtc->lr);
+		} while (seqlock_read_retry(&vrtc->time_lock, seq));
+
+		*value = lr;
 	} else if (offset == offsetof(vrtc_pl031_t, RTCCR)) {
 		// Always enabled
 		*value = 1U;
@@ -100,11 +113,14 @@ vrtc_pl031_reg_write(vrtc_t *vrtc, size_t offset, register_t *value)
 	if (offset == offsetof(vrtc_pl031_t, RTCLR)) {
 		ticks_t value_ticks = platform_timer_convert_ns_to_ticks(
 			*value * TIMER_NANOSECS_IN_SECOND);
-		preempt_disable();
-		ticks_t now	= platform_timer_get_current_ticks();
-		vrtc->time_base = value_ticks - now;
-		preempt_enable();
-		vrtc->lr = (rtc_seconds_t)(*value);
+
+		// Update the time base and load register together, so
+		// concurrent writes from other vCPUs can't mix them up.
+		seqlock_write_start(&vrtc->time_lock);
+		ticks_t now = platform_timer_get_current_ticks();
+		atomic_store_relaxed(&vrtc->time_base, value_ticks - now);
+		atomic_store_relaxed(&vrtc->lr, (rtc_seconds_t)(*value));
+		seqlock_write_finish(&vrtc->time_lock);
 	}
 	// The rest of the registers are WI.
 }